@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "affinity.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#include <sched.h>
+#include <pthread.h>
+
+
+/**
+ * Pin the calling thread to a CPU, or do nothing if the CPU is -1.
+ * Returns 0, or an errno value if it cannot be done.
+ */
+int pin(const int cpu)
+{
+    if(cpu==-1) return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+
+/**
+ * Like pin(), but with a warning to stderr if it cannot be done.
+ */
+void pin_thread(const int cpu)
+{
+    const int err = pin(cpu);
+    if(err) {
+	std::cerr << "warning: cannot pin thread to cpu " << cpu
+		  << ": " << std::strerror(err) << '\n';
+    }
+}
+
+
+/**
+ * The CPUs we're allowed to run on, as a list of indices.
+ */
+std::vector<int> cpus()
+{
+    std::vector<int> acc;
+    cpu_set_t set;
+    if(sched_getaffinity(0, sizeof set, &set)==0) {
+	for(int i=0; i<CPU_SETSIZE; i++) {
+	    if(CPU_ISSET(i, &set)) acc.push_back(i);
+	}
+    }
+    return acc;
+}
+
+
+/**
+ * The CPUs for 'n' worker threads, into 'acc': worker i goes on the
+ * i:th CPU we may use, counting from CPU 'first' if that's not -1.
+ * With neither 'first' nor 'spread', or if we cannot tell which CPUs
+ * we may use, they're all -1; not pinned.
+ *
+ * Returns false if 'first' isn't a CPU we may use.
+ */
+bool placement(std::vector<int>& acc, const unsigned n,
+	       const int first, const bool spread)
+{
+    const std::vector<int> cpu = cpus();
+    acc.assign(n, -1);
+    if(cpu.empty() || (first==-1 && !spread)) return true;
+
+    unsigned offset = 0;
+    if(first!=-1) {
+	auto i = std::find(cpu.begin(), cpu.end(), first);
+	if(i==cpu.end()) return false;
+	offset = i - cpu.begin();
+    }
+
+    for(unsigned i=0; i<n; i++) {
+	acc[i] = cpu[(offset + i) % cpu.size()];
+    }
+    return true;
+}
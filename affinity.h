@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_AFFINITY_H
+#define UDPTOOLS_AFFINITY_H
+#include <vector>
+
+int pin(int cpu);
+void pin_thread(int cpu);
+std::vector<int> cpus();
+bool placement(std::vector<int>& acc, unsigned n, int first, bool spread);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+    const unsigned bits = 7;
+    const unsigned sub = 1 << bits;
+
+    unsigned msb(uint64_t val)
+    {
+	return 63 - __builtin_clzll(val | 1);
+    }
+}
+
+
+Histogram::Histogram()
+    : buckets(index(~0ull) + 1),
+      n(0),
+      lo(~0ull),
+      hi(0),
+      sum(0)
+{}
+
+
+/**
+ * The bucket for 'val'.  Below 2*sub, it's the value itself.  Above
+ * that, a value with its highest bit at 'bits + shift' goes in one of
+ * the 'sub' buckets after the ones for the previous shift.
+ */
+unsigned Histogram::index(uint64_t val)
+{
+    const unsigned shift = std::max(msb(val), bits) - bits;
+    return shift * sub + (val >> shift);
+}
+
+
+/**
+ * The highest value which goes into bucket 'index'.
+ */
+uint64_t Histogram::highest(unsigned index)
+{
+    const unsigned shift = index < 2*sub ? 0 : index / sub - 1;
+    const uint64_t low = uint64_t(index - shift * sub) << shift;
+    return low + ((uint64_t(1) << shift) - 1);
+}
+
+
+void Histogram::add(uint64_t val)
+{
+    buckets[index(val)]++;
+    n++;
+    lo = std::min(lo, val);
+    hi = std::max(hi, val);
+    sum += val;
+}
+
+
+void Histogram::add(const Histogram& other)
+{
+    for(unsigned i=0; i<buckets.size(); i++) {
+	buckets[i] += other.buckets[i];
+    }
+    n += other.n;
+    lo = std::min(lo, other.lo);
+    hi = std::max(hi, other.hi);
+    sum += other.sum;
+}
+
+
+/**
+ * The value below which 'p' percent of the values fall, or 0 if
+ * there are none.  The 100th percentile is the maximum.
+ */
+uint64_t Histogram::percentile(double p) const
+{
+    if(!n) return 0;
+    const uint64_t rank = std::max(1.0, std::ceil(n * p / 100));
+    uint64_t acc = 0;
+    for(unsigned i=0; i<buckets.size(); i++) {
+	acc += buckets[i];
+	if(acc >= rank) return std::min(highest(i), hi);
+    }
+    return hi;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_HISTOGRAM_H
+#define UDPTOOLS_HISTOGRAM_H
+#include <vector>
+#include <cstdint>
+
+
+/**
+ * A histogram of 64-bit values (like latencies in ns), HdrHistogram
+ * style: values below 256 have a bucket each, and above that each
+ * power of two is split into 128 buckets, so any value is known to
+ * within 1%, and the whole range fits in 7.5K buckets.  Adding a
+ * value is a couple of shifts and an increment.
+ *
+ * percentile() is the highest value in the bucket where the
+ * percentile falls, so it errs on the side of "slower".
+ */
+class Histogram {
+public:
+    Histogram();
+
+    void add(uint64_t val);
+    void add(const Histogram& other);
+
+    uint64_t count() const { return n; }
+    uint64_t min() const { return lo; }
+    uint64_t max() const { return hi; }
+    double mean() const { return n ? sum / n : 0; }
+    uint64_t percentile(double p) const;
+
+    static unsigned index(uint64_t val);
+    static uint64_t highest(unsigned index);
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t n;
+    uint64_t lo;
+    uint64_t hi;
+    double sum;
+};
+
+#endif
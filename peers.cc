@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "peers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+namespace {
+
+    unsigned pow2(unsigned n)
+    {
+	unsigned p = 1;
+	while(p < n) p <<= 1;
+	return p;
+    }
+
+    uint64_t hash(const Peers::Key& key)
+    {
+	uint64_t a;
+	uint64_t b;
+	std::memcpy(&a, key.addr, sizeof a);
+	std::memcpy(&b, key.addr + sizeof a, sizeof b);
+
+	uint64_t h = a ^ (uint64_t(key.port) << 16 | key.family);
+	h *= 0x9e3779b97f4a7c15ull;
+	h ^= b ^ h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	return h ^ h >> 32;
+    }
+
+    bool empty(const Peers::Peer& p)
+    {
+	return !p.key.family;
+    }
+
+    /**
+     * The burst, but at least one, and at least what arrives at
+     * 'pps' during one clock tick.
+     */
+    unsigned clamp(double pps, unsigned burst, uint64_t tick)
+    {
+	const double per_tick = std::ceil(pps * tick / 1e9);
+	return std::max({burst, 1u, unsigned(std::min(per_tick, 1e9))});
+    }
+}
+
+
+Peers::Peers(unsigned size, unsigned window)
+    : evicted(0),
+      mask(pow2(std::max(size, 1u)) - 1),
+      window(std::min(window, mask + 1)),
+      table(mask + 1)
+{}
+
+
+bool Peers::Key::operator== (const Key& other) const
+{
+    return family==other.family
+	&& port==other.port
+	&& std::memcmp(addr, other.addr, sizeof addr)==0;
+}
+
+
+/**
+ * The numerical address and port, as in "10.0.0.1:7" or "[::1]:7".
+ */
+std::string Peers::Key::str() const
+{
+    char buf[INET6_ADDRSTRLEN + 10];
+    const int af = family==6 ? AF_INET6 : AF_INET;
+    if(!inet_ntop(af, addr, buf, sizeof buf)) return "?";
+
+    std::string s = af==AF_INET6 ? '[' + std::string(buf) + ']' : buf;
+    return s + ':' + std::to_string(ntohs(port));
+}
+
+
+/**
+ * The key for an AF_INET or AF_INET6 address.  Anything else gets
+ * an all-zero address, and ends up as one single peer.
+ */
+Peers::Key Peers::key_of(const sockaddr& sa)
+{
+    Key key {};
+    if(sa.sa_family==AF_INET) {
+	const auto& in = reinterpret_cast<const sockaddr_in&>(sa);
+	key.family = 4;
+	key.port = in.sin_port;
+	std::memcpy(key.addr, &in.sin_addr, sizeof in.sin_addr);
+    }
+    else if(sa.sa_family==AF_INET6) {
+	const auto& in6 = reinterpret_cast<const sockaddr_in6&>(sa);
+	key.family = 6;
+	key.port = in6.sin6_port;
+	std::memcpy(key.addr, &in6.sin6_addr, sizeof in6.sin6_addr);
+    }
+    else {
+	key.family = 0xffff;
+    }
+    return key;
+}
+
+
+/**
+ * Like key_of(), but for the address alone; the port is zero.
+ */
+Peers::Key Peers::addr_of(const sockaddr& sa)
+{
+    Key key = key_of(sa);
+    key.port = 0;
+    return key;
+}
+
+
+/**
+ * The entry for 'key', which is created (and perhaps replaces the
+ * least recently seen peer in the window) if it's not there.  Either
+ * way, it's marked as seen at time 'now'.
+ */
+Peers::Peer& Peers::lookup(const Key& key, uint64_t now)
+{
+    const unsigned home = hash(key) & mask;
+    Peer* victim = nullptr;
+
+    for(unsigned i=0; i<window; i++) {
+	Peer& p = table[(home + i) & mask];
+	if(p.key==key) {
+	    p.seen = now;
+	    return p;
+	}
+	if(empty(p)) {
+	    victim = &p;
+	    break;
+	}
+	if(!victim || p.seen < victim->seen) {
+	    victim = &p;
+	}
+    }
+
+    if(!empty(*victim)) evicted++;
+
+    Peer& p = *victim;
+    p = Peer {};
+    p.key = key;
+    p.seen = now;
+    return p;
+}
+
+
+/**
+ * The 'n' peers with the most packets, in descending order.
+ */
+std::vector<Peers::Peer> Peers::top(unsigned n) const
+{
+    std::vector<Peer> acc;
+    for(const Peer& p : table) {
+	if(!empty(p)) acc.push_back(p);
+    }
+
+    auto more = [] (const Peer& a, const Peer& b) {
+	return a.packets > b.packets;
+    };
+    if(acc.size() > n) {
+	std::partial_sort(acc.begin(), acc.begin() + n, acc.end(), more);
+	acc.resize(n);
+    }
+    else {
+	std::sort(acc.begin(), acc.end(), more);
+    }
+    return acc;
+}
+
+
+Limit::Limit(double pps, unsigned burst, uint64_t tick)
+    : interval(std::max(1e9 / pps, 1.0)),
+      tau(interval * (clamp(pps, burst, tick) - 1))
+{}
+
+
+/**
+ * Admit 'n' datagrams arriving at time 'now', or none of them.
+ */
+bool Limit::admit(uint64_t& tat, uint64_t now, unsigned n) const
+{
+    const uint64_t t = std::max(tat, now);
+    if(t + (n - 1) * interval - now > tau) return false;
+    tat = t + n * interval;
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_PEERS_H
+#define UDPTOOLS_PEERS_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <sys/socket.h>
+
+
+/**
+ * Statistics per peer (remote address and port), in a table of
+ * bounded size.
+ *
+ * It's a flat, open-addressing hash table, where a peer may only
+ * live within 'window' slots of its home slot.  When those are all
+ * taken, the one seen least recently is evicted.  So memory use is
+ * fixed, a lookup never probes far, and the peers which are active
+ * right now are the ones which stay.
+ */
+class Peers {
+public:
+    explicit Peers(unsigned size, unsigned window = 8);
+
+    struct Key {
+	uint16_t family;
+	uint16_t port;
+	uint8_t addr[16];
+
+	bool operator== (const Key& other) const;
+	std::string str() const;
+    };
+
+    struct Peer {
+	Key key;
+	uint64_t packets;
+	uint64_t octets;
+	uint64_t seen;
+	uint64_t tat;
+    };
+
+    static Key key_of(const sockaddr& sa);
+    static Key addr_of(const sockaddr& sa);
+
+    Peer& lookup(const Key& key, uint64_t now);
+
+    std::vector<Peer> top(unsigned n) const;
+    unsigned size() const { return mask + 1; }
+
+    uint64_t evicted;
+
+private:
+    const unsigned mask;
+    const unsigned window;
+    std::vector<Peer> table;
+};
+
+
+/**
+ * A rate limit of 'pps' datagrams per second, with bursts of up to
+ * 'burst' datagrams.  It's a token bucket, but in its GCRA form:
+ * instead of a token count which needs refilling, each source has a
+ * "theoretical arrival time" (Peer::tat) for its next datagram, and
+ * a datagram is admitted unless it's too early for that.
+ *
+ * 'pps' is at most 1e9, or the interval would be less than a ns, and
+ * at least 1, so that 'tau' cannot overflow.
+ *
+ * Times are in ns, from a clock which ticks every 'tick' ns.  A
+ * coarse clock makes a whole tick's worth of datagrams look like
+ * they arrive at once, so the burst is raised to at least that many
+ * (pps * tick); a smaller one would cap the rate well below 'pps'.
+ */
+class Limit {
+public:
+    Limit(double pps, unsigned burst, uint64_t tick = 0);
+
+    bool admit(uint64_t& tat, uint64_t now, unsigned n = 1) const;
+    unsigned burst() const { return tau / interval + 1; }
+
+    const uint64_t interval;
+    const uint64_t tau;
+};
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "portrange.h"
+
+#include <cstdlib>
+#include <cctype>
+
+
+/**
+ * Parse a port range like "10000-19999" into its first and last
+ * port.  Anything else (a single port, a service name) isn't a
+ * range, and neither is one which runs backwards.  'first' and
+ * 'last' are only touched if it's a range.
+ */
+bool port_range(const std::string& s, unsigned& first, unsigned& last)
+{
+    const char* p = s.c_str();
+    char* end;
+    if(!std::isdigit(static_cast<unsigned char>(*p))) return false;
+    const unsigned long a = std::strtoul(p, &end, 10);
+    if(*end!='-') return false;
+    p = end + 1;
+    if(!std::isdigit(static_cast<unsigned char>(*p))) return false;
+    const unsigned long b = std::strtoul(p, &end, 10);
+    if(*end || !a || a > b || b > 65535) return false;
+
+    first = a;
+    last = b;
+    return true;
+}
@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_PORTRANGE_H
+#define UDPTOOLS_PORTRANGE_H
+#include <string>
+
+bool port_range(const std::string& s, unsigned& first, unsigned& last);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "profile.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+
+
+namespace {
+
+    /**
+     * Parse a duration like "2", "2s", "500ms", "100us" or "10ns",
+     * into seconds.
+     */
+    bool duration(const std::string& s, double& val)
+    {
+	const char* p = s.c_str();
+	char* end;
+	double d = std::strtod(p, &end);
+	if(end==p || d < 0) return false;
+
+	const std::string unit = end;
+	if(unit=="ms") d *= 1e-3;
+	else if(unit=="us") d *= 1e-6;
+	else if(unit=="ns") d *= 1e-9;
+	else if(unit!="" && unit!="s") return false;
+
+	val = d;
+	return true;
+    }
+
+    bool number(const char* p, char** end, unsigned& val)
+    {
+	if(*p < '0' || *p > '9') return false;
+	val = std::strtoul(p, end, 10);
+	return true;
+    }
+
+    bool number(const std::string& s, unsigned& val)
+    {
+	char* end;
+	return number(s.c_str(), &end, val) && !*end;
+    }
+
+    /**
+     * A rate "r", or a ramp "r-r2".
+     */
+    bool rate(const std::string& s, double& r, double& r2)
+    {
+	const char* p = s.c_str();
+	char* end;
+	r = r2 = std::strtod(p, &end);
+	if(end==p || r < 0) return false;
+	if(*end=='-') {
+	    p = end + 1;
+	    r2 = std::strtod(p, &end);
+	    if(end==p || r2 < 0) return false;
+	}
+	return !*end;
+    }
+
+    bool sizes(const std::string& s, Phase& phase)
+    {
+	auto& v = phase.sizes;
+	v.clear();
+	if(s=="imix") {
+	    v = {{64 - 28, 7}, {576 - 28, 4}, {1500 - 28, 1}};
+	    return true;
+	}
+
+	const char* p = s.c_str();
+	char* end;
+	unsigned a;
+	unsigned b;
+	if(!number(p, &end, a)) return false;
+
+	if(*end=='-') {
+	    if(!number(end + 1, &end, b) || *end || b < a) return false;
+	    v = {{a, 1}, {b, 1}};
+	    phase.uniform = true;
+	}
+	else {
+	    for(;;) {
+		b = 1;
+		if(*end==':' && !number(end + 1, &end, b)) return false;
+		v.push_back({a, b});
+		if(!*end) break;
+		if(*end!=',' || !number(end + 1, &end, a)) return false;
+	    }
+	}
+
+	unsigned weight = 0;
+	for(const auto& size : v) {
+	    if(size.first < 1 || size.first > 65507) return false;
+	    weight += size.second;
+	}
+	return weight;
+    }
+
+    /**
+     * The size table for a phase: 'size' throughout if it doesn't
+     * say, random numbers for a uniform distribution, or else each
+     * size its share of the entries, shuffled.  The seed is fixed, so
+     * a profile always gives the same sizes.
+     */
+    std::vector<uint16_t> table(const Phase& phase, unsigned size)
+    {
+	const unsigned n = Schedule::tablesize;
+	std::vector<uint16_t> v;
+	std::mt19937 rng(4711);
+
+	if(phase.sizes.empty()) {
+	    v.assign(n, size);
+	}
+	else if(phase.uniform) {
+	    std::uniform_int_distribution<unsigned> dist(phase.sizes[0].first,
+							 phase.sizes[1].first);
+	    while(v.size() < n) v.push_back(dist(rng));
+	}
+	else {
+	    unsigned total = 0;
+	    for(const auto& s : phase.sizes) total += s.second;
+	    unsigned acc = 0;
+	    for(const auto& s : phase.sizes) {
+		acc += s.second;
+		const size_t end = (uint64_t(n) * acc + total / 2) / total;
+		v.resize(end, s.first);
+	    }
+	    std::shuffle(v.begin(), v.end(), rng);
+	}
+	return v;
+    }
+}
+
+
+/**
+ * Add a phase, or do nothing if 'line' is empty.  Returns false if
+ * it's malformed, or makes no sense: it must have a duration, and a
+ * rate unless it's bursts with gaps between.  A ramp cannot start or
+ * end at "as fast as possible".
+ */
+bool Profile::add(const std::string& line)
+{
+    std::istringstream is(line.substr(0, line.find('#')));
+    Phase phase;
+    bool empty = true;
+    std::string s;
+    while(is >> s) {
+	empty = false;
+	const size_t eq = s.find('=');
+	if(eq==std::string::npos) return false;
+	const std::string key = s.substr(0, eq);
+	const std::string val = s.substr(eq + 1);
+
+	bool ok;
+	if(key=="time") ok = duration(val, phase.time);
+	else if(key=="rate") ok = rate(val, phase.rate, phase.rate2);
+	else if(key=="burst") ok = number(val, phase.burst);
+	else if(key=="gap") ok = duration(val, phase.gap);
+	else if(key=="size") ok = sizes(val, phase);
+	else ok = false;
+	if(!ok) return false;
+    }
+
+    if(empty) return true;
+
+    if(phase.time <= 0) return false;
+    if(phase.rate!=phase.rate2) {
+	if(!phase.rate || !phase.rate2) return false;
+    }
+    else if(!phase.rate && !(phase.burst && phase.gap > 0)) {
+	return false;
+    }
+
+    phases.push_back(phase);
+    return true;
+}
+
+
+/**
+ * The schedule for one of several threads which share the profile,
+ * so each one gets 'share' of the rate and (rounded up) of each
+ * burst.  Phases without sizes get 'size'.
+ */
+Schedule::Schedule(const Profile& profile, double share, unsigned size)
+{
+    const double slice = 10e6;
+    uint64_t t = 0;
+
+    for(unsigned i=0; i<profile.phases.size(); i++) {
+	const Phase& p = profile.phases[i];
+	sizes.push_back(table(p, size));
+
+	const double len = p.time * 1e9;
+	const double r = p.rate * share;
+	const double r2 = p.rate2 * share;
+	const uint64_t burst = p.burst ? std::ceil(p.burst * share) : 0;
+	const double gap = p.gap * 1e9;
+
+	if(r==r2) {
+	    const double interval = r ? 1e9 / r : 0;
+	    if(burst) {
+		const double period = burst * interval + gap;
+		const uint64_t repeat = std::max(1.0, std::floor(len / period));
+		steps.push_back({t, interval, burst, repeat, period, i});
+	    }
+	    else {
+		const uint64_t n = std::llround(p.time * r);
+		steps.push_back({t, interval, n, 1, 0, i});
+	    }
+	}
+	else if(burst) {
+	    double s = 0;
+	    while(s < len) {
+		const double interval = 1e9 / (r + (r2 - r) * s / len);
+		steps.push_back({t + uint64_t(s), interval, burst, 1, 0, i});
+		s += burst * interval + gap;
+	    }
+	}
+	else {
+	    double owed = 0;
+	    for(double s = 0; s < len; s += slice) {
+		const double l = std::min(slice, len - s);
+		const double rr = r + (r2 - r) * (s + l/2) / len;
+		owed += rr * l * 1e-9;
+		const uint64_t n = owed;
+		owed -= n;
+		if(n) steps.push_back({t + uint64_t(s), 1e9 / rr, n, 1, 0, i});
+	    }
+	}
+
+	t += len;
+    }
+}
+
+
+/**
+ * Just 'count' datagrams of 'size' octets, at 'rate' (or as fast as
+ * possible).
+ */
+Schedule::Schedule(uint64_t count, double rate, unsigned size)
+    : steps {{0, rate ? 1e9 / rate : 0, count, 1, 0, 0}},
+      sizes {std::vector<uint16_t>(tablesize, size)}
+{}
+
+
+uint64_t Schedule::total() const
+{
+    uint64_t n = 0;
+    for(const Step& s : steps) n += s.count * s.repeat;
+    return n;
+}
+
+
+unsigned Schedule::maxsize() const
+{
+    unsigned n = 0;
+    for(const auto& v : sizes) {
+	n = std::max<unsigned>(n, *std::max_element(v.begin(), v.end()));
+    }
+    return n;
+}
+
+
+unsigned Schedule::minsize() const
+{
+    unsigned n = 65535;
+    for(const auto& v : sizes) {
+	n = std::min<unsigned>(n, *std::min_element(v.begin(), v.end()));
+    }
+    return n;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_PROFILE_H
+#define UDPTOOLS_PROFILE_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+/**
+ * A traffic profile for udppump --profile: a sequence of phases, one
+ * per line, each a list of key=value settings:
+ *
+ *    time=5s rate=10000 size=imix
+ *    time=5s rate=1000-100000 size=64-1472
+ *    time=10s rate=0 burst=200 gap=2ms size=36:7,548:4,1472:1
+ *
+ * time   how long the phase lasts (s, ms, us or ns; seconds by default)
+ * rate   datagrams per second while sending, or a linear ramp a-b;
+ *        0 means as fast as possible, which needs bursts
+ * burst  datagrams per burst; without it, there are no pauses
+ * gap    the pause after each burst
+ * size   the payload size: fixed (N), uniform (N-M), weighted
+ *        (N:w,M:w,...) or "imix", i.e. IP packets of 64, 576 and
+ *        1500 octets in the proportions 7:4:1
+ *
+ * Empty lines and #-comments are ignored, and so is a phase's
+ * size if it has none; then the default size is used.
+ */
+struct Phase {
+    double time = 0;
+    double rate = 0;
+    double rate2 = 0;
+    unsigned burst = 0;
+    double gap = 0;
+    std::vector<std::pair<unsigned, unsigned>> sizes;
+    bool uniform = false;
+};
+
+class Profile {
+public:
+    bool add(const std::string& line);
+    std::vector<Phase> phases;
+};
+
+
+/**
+ * A profile, or a plain count and rate, as a list of steps for the
+ * send loop: 'count' datagrams 'interval' ns apart, starting at
+ * 'start' ns, and that again 'repeat' times, 'period' ns apart.
+ * A constant phase is a single step; a ramp is a step per burst, or
+ * per 10 ms if there are no bursts.
+ *
+ * The payload sizes come from a table per phase, with 'tablesize'
+ * entries shuffled once up front, so the send loop just steps
+ * through it.
+ *
+ * If 'limit' isn't 0, sending stops after that many ns, whatever the
+ * steps say.
+ */
+class Schedule {
+public:
+    Schedule(const Profile& profile, double share, unsigned size);
+    Schedule(uint64_t count, double rate, unsigned size);
+
+    struct Step {
+	uint64_t start;
+	double interval;
+	uint64_t count;
+	uint64_t repeat;
+	double period;
+	unsigned phase;
+    };
+
+    static constexpr unsigned tablesize = 4096;
+
+    std::vector<Step> steps;
+    std::vector<std::vector<uint16_t>> sizes;
+    uint64_t limit = 0;
+
+    uint64_t total() const;
+    unsigned maxsize() const;
+    unsigned minsize() const;
+};
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "rcvbuf.h"
+
+#include <sys/socket.h>
+
+
+/**
+ * Set the socket receive buffer size to 'size', or as close as we
+ * can get: SO_RCVBUF is capped by net.core.rmem_max, and
+ * SO_RCVBUFFORCE needs CAP_NET_ADMIN.  Returns what the kernel says
+ * it granted, which on Linux is twice the requested size to allow
+ * for its bookkeeping.
+ */
+int rcvbuf(const int fd, const int size)
+{
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size)) {
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    }
+
+    int granted = 0;
+    socklen_t len = sizeof granted;
+    (void)getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &granted, &len);
+    return granted;
+}
@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_RCVBUF_H
+#define UDPTOOLS_RCVBUF_H
+
+int rcvbuf(int fd, int size);
+
+#endif
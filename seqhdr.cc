@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "seqhdr.h"
+
+
+namespace {
+
+    void put(uint8_t* p, uint64_t val, unsigned n)
+    {
+	while(n--) {
+	    p[n] = val & 0xff;
+	    val >>= 8;
+	}
+    }
+
+    uint64_t get(const uint8_t* p, unsigned n)
+    {
+	uint64_t val = 0;
+	while(n--) {
+	    val = val << 8 | *p++;
+	}
+	return val;
+    }
+}
+
+
+/**
+ * Write the header to 'buf', which has room for SeqHdr::size
+ * octets.
+ */
+void SeqHdr::put(uint8_t* buf) const
+{
+    ::put(buf, magic, 2);
+    ::put(buf + 2, 0, 1);
+    ::put(buf + 3, clock, 1);
+    ::put(buf + 4, flow, 4);
+    ::put(buf + 8, seq, 8);
+    ::put(buf + 16, t, 8);
+}
+
+
+/**
+ * Read the header from a datagram of 'len' octets, or return false
+ * if it doesn't start with one.
+ */
+bool SeqHdr::get(const uint8_t* buf, size_t len)
+{
+    if(len < size) return false;
+    if(::get(buf, 2)!=magic || buf[2]!=0 || buf[3] > TAI) return false;
+
+    clock = Clock(buf[3]);
+    flow = ::get(buf + 4, 4);
+    seq = ::get(buf + 8, 8);
+    t = ::get(buf + 16, 8);
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#ifndef UDPTOOLS_SEQHDR_H
+#define UDPTOOLS_SEQHDR_H
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * The header udppump --stamp puts first in each datagram, so that a
+ * receiver can tell lost, reordered and duplicated datagrams apart,
+ * and see how long they took.  On the wire, in network byte order:
+ *
+ *    0  magic     16 bits   0x5550 ("UP")
+ *    2  version    8 bits   0
+ *    3  clock      8 bits   REALTIME or TAI
+ *    4  flow      32 bits
+ *    8  seq       64 bits   per flow, from 0
+ *   16  time      64 bits   ns since the epoch, when sent
+ *
+ * Whatever follows is padding.
+ */
+struct SeqHdr {
+    static const unsigned size = 24;
+    static const uint16_t magic = 0x5550;
+    enum Clock { REALTIME = 0, TAI = 1 };
+
+    Clock clock;
+    uint32_t flow;
+    uint64_t seq;
+    uint64_t t;
+
+    void put(uint8_t* buf) const;
+    bool get(const uint8_t* buf, size_t len);
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <affinity.h>
+
+#include <orchis.h>
+#include <algorithm>
+
+#include <sched.h>
+
+
+namespace affinity {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_cpus()
+    {
+	const std::vector<int> v = cpus();
+	assert_true(!v.empty());
+	assert_true(std::is_sorted(v.begin(), v.end()));
+	assert_true(std::find(v.begin(), v.end(), sched_getcpu()) != v.end());
+    }
+
+    void test_pin()
+    {
+	assert_eq(pin(-1), 0);
+
+	cpu_set_t saved;
+	sched_getaffinity(0, sizeof saved, &saved);
+
+	const int cpu = cpus().back();
+	assert_eq(pin(cpu), 0);
+	assert_eq(cpus().size(), 1);
+	assert_eq(cpus().front(), cpu);
+	assert_eq(sched_getcpu(), cpu);
+
+	sched_setaffinity(0, sizeof saved, &saved);
+    }
+
+    void test_placement()
+    {
+	const std::vector<int> cpu = cpus();
+	std::vector<int> v;
+
+	assert_true(placement(v, 3, -1, false));
+	assert_eq(v.size(), 3);
+	assert_eq(v[0], -1);
+	assert_eq(v[2], -1);
+
+	assert_true(placement(v, 2, -1, true));
+	assert_eq(v.size(), 2);
+	assert_eq(v[0], cpu[0]);
+	assert_eq(v[1], cpu[1 % cpu.size()]);
+
+	assert_true(placement(v, 2, cpu.back(), false));
+	assert_eq(v[0], cpu.back());
+	assert_eq(v[1], cpu.front());
+
+	assert_true(!placement(v, 1, 100000, true));
+    }
+}
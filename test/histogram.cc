@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <histogram.h>
+
+#include <orchis.h>
+
+
+namespace histogram {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_index()
+    {
+	assert_eq(Histogram::index(0), 0);
+	assert_eq(Histogram::index(255), 255);
+	assert_eq(Histogram::index(256), 256);
+	assert_eq(Histogram::index(257), 256);
+	assert_eq(Histogram::index(258), 257);
+	assert_eq(Histogram::index(511), 383);
+	assert_eq(Histogram::index(512), 384);
+	assert_eq(Histogram::highest(255), 255);
+	assert_eq(Histogram::highest(256), 257);
+	assert_eq(Histogram::highest(383), 511);
+	assert_eq(Histogram::highest(Histogram::index(~0ull)), ~0ull);
+    }
+
+    void test_precision()
+    {
+	for(uint64_t v = 1; v < 1ull << 62; v = v * 3 + 1) {
+	    const unsigned i = Histogram::index(v);
+	    const uint64_t h = Histogram::highest(i);
+	    assert_true(h >= v);
+	    assert_true(h - v <= v / 128);
+	    assert_true(i==0 || Histogram::highest(i - 1) < v);
+	}
+    }
+
+    void test_percentile()
+    {
+	Histogram h;
+	assert_eq(h.percentile(50), 0);
+	for(unsigned v=1; v<=1000; v++) h.add(v * 1000);
+
+	assert_eq(h.count(), 1000);
+	assert_eq(h.min(), 1000);
+	assert_eq(h.max(), 1000000);
+	assert_eq(h.mean(), 500500);
+	const uint64_t p50 = h.percentile(50);
+	assert_true(p50 >= 500000 && p50 <= 505000);
+	const uint64_t p99 = h.percentile(99);
+	assert_true(p99 >= 990000 && p99 <= 1000000);
+	assert_eq(h.percentile(100), 1000000);
+	assert_eq(h.percentile(0), Histogram::highest(Histogram::index(1000)));
+    }
+
+    void test_merge()
+    {
+	Histogram a;
+	Histogram b;
+	a.add(10);
+	b.add(5);
+	b.add(20);
+	a.add(b);
+	assert_eq(a.count(), 3);
+	assert_eq(a.min(), 5);
+	assert_eq(a.max(), 20);
+	assert_eq(a.percentile(50), 10);
+    }
+}
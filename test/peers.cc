@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <peers.h>
+
+#include <orchis.h>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+namespace {
+
+    Peers::Key v4(const char* addr, unsigned port)
+    {
+	sockaddr_in sa {};
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	inet_pton(AF_INET, addr, &sa.sin_addr);
+	return Peers::key_of(reinterpret_cast<const sockaddr&>(sa));
+    }
+
+    Peers::Key v6(const char* addr, unsigned port)
+    {
+	sockaddr_in6 sa {};
+	sa.sin6_family = AF_INET6;
+	sa.sin6_port = htons(port);
+	inet_pton(AF_INET6, addr, &sa.sin6_addr);
+	return Peers::key_of(reinterpret_cast<const sockaddr&>(sa));
+    }
+}
+
+
+namespace peers {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_key()
+    {
+	assert_eq(v4("10.0.0.1", 7).str(), "10.0.0.1:7");
+	assert_eq(v6("::1", 4711).str(), "[::1]:4711");
+	assert_true(v4("10.0.0.1", 7) == v4("10.0.0.1", 7));
+	assert_true(!(v4("10.0.0.1", 7) == v4("10.0.0.1", 8)));
+	assert_true(!(v4("10.0.0.1", 7) == v4("10.0.0.2", 7)));
+    }
+
+    void test_addr()
+    {
+	sockaddr_in a {};
+	a.sin_family = AF_INET;
+	a.sin_port = htons(7);
+	inet_pton(AF_INET, "10.0.0.1", &a.sin_addr);
+	sockaddr_in b = a;
+	b.sin_port = htons(8);
+
+	const auto& sa = reinterpret_cast<const sockaddr&>(a);
+	const auto& sb = reinterpret_cast<const sockaddr&>(b);
+	assert_true(Peers::addr_of(sa) == Peers::addr_of(sb));
+	assert_true(!(Peers::key_of(sa) == Peers::key_of(sb)));
+	assert_eq(Peers::addr_of(sa).str(), "10.0.0.1:0");
+    }
+
+    void test_size()
+    {
+	assert_eq(Peers(1000).size(), 1024);
+	assert_eq(Peers(1024).size(), 1024);
+	assert_eq(Peers(0).size(), 1);
+    }
+
+    void test_lookup()
+    {
+	Peers peers(16);
+	Peers::Peer& a = peers.lookup(v4("10.0.0.1", 7), 1);
+	a.packets++;
+	Peers::Peer& b = peers.lookup(v4("10.0.0.2", 7), 2);
+	b.packets++;
+	Peers::Peer& c = peers.lookup(v4("10.0.0.1", 7), 3);
+	c.packets++;
+
+	assert_eq(&a, &c);
+	assert_eq(a.packets, 2);
+	assert_eq(a.seen, 3);
+	assert_eq(b.packets, 1);
+	assert_eq(peers.evicted, 0);
+    }
+
+    void test_evict()
+    {
+	/* everything lives in the same window */
+	Peers peers(4, 4);
+	for(unsigned i=0; i<4; i++) {
+	    peers.lookup(v4("10.0.0.1", i), 10 + i).packets = 100;
+	}
+	peers.lookup(v4("10.0.0.1", 0), 20);
+	assert_eq(peers.evicted, 0);
+
+	/* port 1 is now the least recently seen */
+	Peers::Peer& p = peers.lookup(v4("10.0.0.1", 4), 30);
+	assert_eq(peers.evicted, 1);
+	assert_eq(p.packets, 0);
+	assert_eq(p.key.str(), "10.0.0.1:4");
+
+	assert_eq(peers.lookup(v4("10.0.0.1", 0), 31).packets, 100);
+	assert_eq(peers.lookup(v4("10.0.0.1", 1), 32).packets, 0);
+	assert_eq(peers.evicted, 2);
+    }
+
+    void test_limit()
+    {
+	const Limit limit(1000, 3);
+	assert_eq(limit.interval, 1000000);
+	assert_eq(limit.tau, 2000000);
+
+	const uint64_t ms = 1000000;
+	uint64_t tat = 0;
+	uint64_t now = 10*ms;
+	assert_true(limit.admit(tat, now));
+	assert_true(limit.admit(tat, now));
+	assert_true(limit.admit(tat, now));
+	assert_true(!limit.admit(tat, now));
+	assert_true(!limit.admit(tat, now));
+
+	now += ms;
+	assert_true(limit.admit(tat, now));
+	assert_true(!limit.admit(tat, now));
+
+	now += 10*ms;
+	assert_true(!limit.admit(tat, now, 4));
+	assert_true(limit.admit(tat, now, 3));
+	assert_true(!limit.admit(tat, now));
+    }
+
+    void test_limit_tick()
+    {
+	const uint64_t ms = 1000000;
+	assert_eq(Limit(1000, 3).burst(), 3);
+	assert_eq(Limit(1000, 0).burst(), 1);
+	assert_eq(Limit(1000, 3, 4*ms).burst(), 4);
+	assert_eq(Limit(1000, 10, 4*ms).burst(), 10);
+	assert_eq(Limit(100000, 1, 4*ms).burst(), 400);
+	assert_eq(Limit(2e9, 3).interval, 1);
+	assert_eq(Limit(2e9, 3).burst(), 3);
+
+	/* a clock which only ticks every 4 ms still lets 100000 pps
+	 * through
+	 */
+	const Limit limit(100000, 1, 4*ms);
+	uint64_t tat = 0;
+	unsigned admitted = 0;
+	for(unsigned i=0; i<100000; i++) {
+	    const uint64_t now = 10*ms + (i * 10000ull) / (4*ms) * (4*ms);
+	    if(limit.admit(tat, now)) admitted++;
+	}
+	assert_true(admitted > 99000);
+    }
+
+    void test_top()
+    {
+	Peers peers(64);
+	for(unsigned i=1; i<=10; i++) {
+	    peers.lookup(v4("10.0.0.1", i), 0).packets = i;
+	}
+
+	const auto v = peers.top(3);
+	assert_eq(v.size(), 3);
+	assert_eq(v[0].packets, 10);
+	assert_eq(v[1].packets, 9);
+	assert_eq(v[2].packets, 8);
+	assert_eq(peers.top(100).size(), 10);
+    }
+}
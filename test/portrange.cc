@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <portrange.h>
+
+#include <orchis.h>
+
+
+namespace portrange {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_range()
+    {
+	unsigned first = 0;
+	unsigned last = 0;
+	assert_true(port_range("10000-19999", first, last));
+	assert_eq(first, 10000);
+	assert_eq(last, 19999);
+	assert_true(port_range("7-7", first, last));
+	assert_eq(first, 7);
+	assert_eq(last, 7);
+	assert_true(port_range("1-65535", first, last));
+	assert_eq(first, 1);
+	assert_eq(last, 65535);
+    }
+
+    void test_not_range()
+    {
+	unsigned first = 4711;
+	unsigned last = 4711;
+	assert_true(!port_range("7001", first, last));
+	assert_true(!port_range("echo", first, last));
+	assert_true(!port_range("", first, last));
+	assert_true(!port_range("-", first, last));
+	assert_true(!port_range("7001-", first, last));
+	assert_true(!port_range("-7001", first, last));
+	assert_true(!port_range("7001-x", first, last));
+	assert_true(!port_range("7001-7002x", first, last));
+	assert_true(!port_range("x7001-7002", first, last));
+	assert_true(!port_range("7002-7001", first, last));
+	assert_true(!port_range("0-10", first, last));
+	assert_true(!port_range("1-65536", first, last));
+	assert_true(!port_range("7001--7002", first, last));
+	assert_true(!port_range("7001-+7002", first, last));
+	assert_eq(first, 4711);
+	assert_eq(last, 4711);
+    }
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <profile.h>
+
+#include <orchis.h>
+#include <algorithm>
+
+
+namespace {
+
+    Profile parse(const char* line)
+    {
+	Profile p;
+	orchis::assert_true(p.add(line));
+	return p;
+    }
+
+    unsigned count(const std::vector<uint16_t>& v, unsigned size)
+    {
+	return std::count(v.begin(), v.end(), size);
+    }
+}
+
+
+namespace profile {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_parse()
+    {
+	const Profile p = parse("time=500ms rate=1000-2000 burst=10 gap=1ms"
+				" size=100:3,200  # comment");
+	assert_eq(p.phases.size(), 1);
+	const Phase& ph = p.phases[0];
+	assert_eq(ph.time, 0.5);
+	assert_eq(ph.rate, 1000);
+	assert_eq(ph.rate2, 2000);
+	assert_eq(ph.burst, 10);
+	assert_eq(ph.gap, 1e-3);
+	assert_eq(ph.sizes.size(), 2);
+	assert_eq(ph.sizes[0].first, 100);
+	assert_eq(ph.sizes[0].second, 3);
+	assert_eq(ph.sizes[1].first, 200);
+	assert_eq(ph.sizes[1].second, 1);
+	assert_true(!ph.uniform);
+    }
+
+    void test_empty()
+    {
+	Profile p;
+	assert_true(p.add(""));
+	assert_true(p.add("   # nothing"));
+	assert_eq(p.phases.size(), 0);
+    }
+
+    void test_bad()
+    {
+	Profile p;
+	assert_true(!p.add("rate=1000"));
+	assert_true(!p.add("time=1 rate=0"));
+	assert_true(!p.add("time=1 rate=0 burst=10"));
+	assert_true(!p.add("time=1 rate=0-1000"));
+	assert_true(!p.add("time=1 rate=1000 size=0"));
+	assert_true(!p.add("time=1 rate=1000 size=70000"));
+	assert_true(!p.add("time=1 rate=1000 size=200-100"));
+	assert_true(!p.add("time=1 rate=1000 size=100:0"));
+	assert_true(!p.add("time=1 rate=1000 size=100,"));
+	assert_true(!p.add("time=1h rate=1000"));
+	assert_true(!p.add("time=1 rate=1000 color=red"));
+	assert_true(!p.add("time=1 rate=1000 burst"));
+	assert_eq(p.phases.size(), 0);
+	assert_true(p.add("time=1 rate=0 burst=10 gap=1ms"));
+    }
+
+    void test_imix()
+    {
+	const Schedule s(parse("time=1 rate=1000 size=imix"), 1, 0);
+	const auto& v = s.sizes[0];
+	assert_eq(v.size(), Schedule::tablesize);
+	assert_eq(count(v, 36), 2389);
+	assert_eq(count(v, 548), 1366);
+	assert_eq(count(v, 1472), 341);
+	assert_eq(s.minsize(), 36);
+	assert_eq(s.maxsize(), 1472);
+
+	/* shuffled, not in runs */
+	assert_true(count(std::vector<uint16_t>(v.begin(), v.begin() + 100),
+			  36) < 100);
+    }
+
+    void test_uniform()
+    {
+	const Schedule s(parse("time=1 rate=1000 size=100-110"), 1, 0);
+	const auto& v = s.sizes[0];
+	for(unsigned n=100; n<=110; n++) {
+	    assert_true(count(v, n) > 4096/11/2);
+	}
+	assert_eq(s.minsize(), 100);
+	assert_eq(s.maxsize(), 110);
+    }
+
+    void test_default_size()
+    {
+	const Schedule s(parse("time=1 rate=1000"), 1, 42);
+	assert_eq(count(s.sizes[0], 42), Schedule::tablesize);
+    }
+
+    void test_constant()
+    {
+	Profile p = parse("time=2 rate=1000");
+	assert_true(p.add("time=1 rate=0 burst=50 gap=10ms"));
+	const Schedule s(p, 1, 100);
+
+	assert_eq(s.steps.size(), 2);
+	const Schedule::Step& a = s.steps[0];
+	assert_eq(a.start, 0);
+	assert_eq(a.interval, 1e6);
+	assert_eq(a.count, 2000);
+	assert_eq(a.repeat, 1);
+
+	const Schedule::Step& b = s.steps[1];
+	assert_eq(b.start, 2000000000);
+	assert_eq(b.interval, 0);
+	assert_eq(b.count, 50);
+	assert_eq(b.repeat, 100);
+	assert_eq(b.period, 1e7);
+	assert_eq(b.phase, 1);
+
+	assert_eq(s.total(), 2000 + 5000);
+    }
+
+    void test_share()
+    {
+	const Schedule s(parse("time=1 rate=1000 burst=5 gap=1ms"), 0.5, 100);
+	assert_eq(s.steps.size(), 1);
+	const Schedule::Step& a = s.steps[0];
+	assert_eq(a.interval, 2e6);
+	assert_eq(a.count, 3);
+	assert_eq(a.period, 7e6);
+	assert_eq(a.repeat, 142);
+    }
+
+    void test_ramp()
+    {
+	const Schedule s(parse("time=1 rate=1000-3000"), 1, 100);
+	assert_eq(s.steps.size(), 100);
+	assert_eq(s.steps[0].count, 10);
+	assert_eq(s.steps[99].count, 30);
+	assert_eq(s.steps[50].start, 500000000);
+	assert_eq(s.total(), 2000);
+    }
+
+    void test_ramp_bursts()
+    {
+	const Schedule s(parse("time=1 rate=1000-2000 burst=10 gap=90ms"), 1, 100);
+	assert_true(s.steps.size() >= 10);
+	assert_eq(s.steps[0].start, 0);
+	assert_eq(s.steps[0].interval, 1e6);
+	assert_eq(s.steps[1].start, 100000000);
+	assert_true(s.steps[1].interval < 1e6);
+	for(const auto& step : s.steps) {
+	    assert_eq(step.count, 10);
+	    assert_true(step.start < 1000000000);
+	}
+    }
+
+    void test_plain()
+    {
+	const Schedule s(1000, 0, 1);
+	assert_eq(s.steps.size(), 1);
+	assert_eq(s.steps[0].interval, 0);
+	assert_eq(s.total(), 1000);
+	assert_eq(s.maxsize(), 1);
+    }
+}
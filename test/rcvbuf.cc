@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <rcvbuf.h>
+
+#include <orchis.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+namespace sockbuf {
+
+    using orchis::assert_true;
+
+    void test_grant()
+    {
+	const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	assert_true(fd!=-1);
+
+	const int small = rcvbuf(fd, 4096);
+	assert_true(small > 0);
+	const int large = rcvbuf(fd, 65536);
+	assert_true(large >= small);
+	assert_true(large <= 2 * 65536);
+
+	assert_true(rcvbuf(-1, 4096)==0);
+	close(fd);
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn
+ * All rights reserved.
+ *
+ */
+#include <seqhdr.h>
+
+#include <orchis.h>
+#include <vector>
+
+
+namespace seqhdr {
+
+    using orchis::assert_eq;
+    using orchis::assert_true;
+
+    void test_layout()
+    {
+	SeqHdr h;
+	h.clock = SeqHdr::TAI;
+	h.flow = 0x01020304;
+	h.seq = 0x05060708090a0b0cull;
+	h.t = 0x0d0e0f1011121314ull;
+
+	uint8_t buf[SeqHdr::size];
+	h.put(buf);
+
+	const std::vector<uint8_t> v(buf, buf + sizeof buf);
+	const std::vector<uint8_t> ref = {
+	    0x55, 0x50, 0x00, 0x01,
+	    0x01, 0x02, 0x03, 0x04,
+	    0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+	    0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14,
+	};
+	assert_true(v==ref);
+    }
+
+    void test_roundtrip()
+    {
+	SeqHdr a;
+	a.clock = SeqHdr::REALTIME;
+	a.flow = 7;
+	a.seq = ~0ull;
+	a.t = 1700000000123456789ull;
+
+	uint8_t buf[100] = {};
+	a.put(buf);
+
+	SeqHdr b;
+	assert_true(b.get(buf, sizeof buf));
+	assert_eq(b.clock, SeqHdr::REALTIME);
+	assert_eq(b.flow, 7);
+	assert_eq(b.seq, ~0ull);
+	assert_eq(b.t, 1700000000123456789ull);
+    }
+
+    void test_short()
+    {
+	SeqHdr a = {};
+	uint8_t buf[SeqHdr::size];
+	a.put(buf);
+
+	SeqHdr b;
+	assert_true(b.get(buf, sizeof buf));
+	assert_true(!b.get(buf, sizeof buf - 1));
+    }
+
+    void test_foreign()
+    {
+	uint8_t buf[SeqHdr::size] = {};
+	SeqHdr b;
+	assert_true(!b.get(buf, sizeof buf));
+
+	SeqHdr a = {};
+	a.put(buf);
+	buf[2] = 1;
+	assert_true(!b.get(buf, sizeof buf));
+	buf[2] = 0;
+	buf[3] = 2;
+	assert_true(!b.get(buf, sizeof buf));
+    }
+}
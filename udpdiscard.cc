@@ -7,27 +7,61 @@
  *
  */
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <iostream>
 #include <ostream>
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/utsname.h>
+
+#include "affinity.h"
+#include "rcvbuf.h"
 
 
 namespace {
 
+    /**
+     * The command-line options, except host and port.  An 'npackets'
+     * of 0 means no limit, which is the default with a control
+     * socket.
+     */
+    struct Options {
+	uint64_t npackets = 1000000;
+	std::string control;
+	unsigned batch = 64;
+	int rcvbuf = 32 << 20;
+	unsigned threads = 0;
+	int cpu = -1;
+    };
+
+    /**
+     * Open a socket bound to host:port.  With 'reuseport',
+     * SO_REUSEPORT is set before binding, so that several sockets
+     * (one per thread) can share the port; the kernel spreads the
+     * flows between them.
+     */
     int udpserver(const std::string& host,
 		  const std::string& port,
-		  const bool nonblocking)
+		  const bool nonblocking,
+		  const bool reuseport = false,
+		  const bool quiet = false)
     {
 	static const struct addrinfo hints = {
 	    AI_PASSIVE | (host.empty() ? 0 : AI_CANONNAME),
@@ -55,9 +89,21 @@ namespace {
 	    return -1;	    
 	}
 
+	if(reuseport) {
+	    const int one = 1;
+	    rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one);
+	    if(rc) {
+		std::cerr << "error: cannot set SO_REUSEPORT: "
+			  << strerror(errno) << '\n';
+		return -1;
+	    }
+	}
+
 	const char * const canon = first.ai_canonname;
-	std::cout << "binding to: "
-		  << (canon? canon : "*") << ':' << port << '\n';
+	if(!quiet) {
+	    std::cout << "binding to: "
+		      << (canon? canon : "*") << ':' << port << '\n';
+	}
 
 	rc = bind(fd, first.ai_addr, first.ai_addrlen);
 	if(rc) {
@@ -76,53 +122,477 @@ namespace {
 	return fd;
     }
 
+    /**
+     * What we've seen so far, and what the kernel says it had to
+     * drop because our receive buffer was full.
+     */
+    struct Counts {
+	uint64_t packets = 0;
+	uint64_t octets = 0;
+	uint64_t drops = 0;
+    };
+
+    /**
+     * Handle a query on the control socket, currently
+     * s.* - show the counts so far
+     * r.* - show the counts since the last 'r'
+     * q.* - quit
+     * The counts are "datagrams octets drops\n", easy for a program
+     * (like udppump --search) to read.  Returning false is a request
+     * to exit.
+     */
+    bool controlmsg(const int fd, const Counts& counts, Counts& baseline)
+    {
+	char buf[100];
+	sockaddr_storage sa;
+	socklen_t salen = sizeof sa;
+	const ssize_t n = recvfrom(fd, buf, sizeof buf, MSG_TRUNC,
+				   reinterpret_cast<sockaddr*>(&sa), &salen);
+	if(n==-1 && errno==EAGAIN) {
+	    return true;
+	}
+	if(n<1) {
+	    return false;
+	}
+
+	const char cmd = buf[0];
+	Counts c = counts;
+	int len;
+	switch(cmd) {
+	case 'r':
+	    c.packets -= baseline.packets;
+	    c.octets -= baseline.octets;
+	    c.drops -= baseline.drops;
+	    baseline = counts;
+	    /* fall through */
+	case 's':
+	    len = std::snprintf(buf, sizeof buf, "%llu %llu %llu\n",
+				static_cast<unsigned long long>(c.packets),
+				static_cast<unsigned long long>(c.octets),
+				static_cast<unsigned long long>(c.drops));
+	    break;
+	case 'q':
+	    len = std::snprintf(buf, sizeof buf, "Goodbye.\n");
+	    break;
+	default:
+	    len = std::snprintf(buf, sizeof buf,
+				"Usage: s, counts; r, counts since the last r;"
+				" q, quit\n");
+	}
+
+	(void)sendto(fd, buf, len, MSG_DONTWAIT,
+		     reinterpret_cast<sockaddr*>(&sa), salen);
+	return cmd != 'q';
+    }
+
+    void epoll_add(int efd, int fd, unsigned index)
+    {
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0; /* keep valgrind happy */
+	ev.data.u32 = index;
+	int err = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+	assert(!err);
+    }
+
+    /**
+     * The headers for one recvmmsg(2) of up to 'size' datagrams.
+     * They all share one octet of payload buffer: with MSG_TRUNC, the
+     * kernel tells the real length anyway, so the counts are right
+     * without copying the datagrams.  Each has room for the
+     * SO_RXQ_OVFL drop counter, and only the first 'used' have been
+     * touched by the kernel since they were last set up.
+     */
+    struct Batch {
+	explicit Batch(unsigned size);
+
+	const unsigned size;
+	unsigned used;
+	char octet;
+	iovec iov;
+	std::vector<mmsghdr> msg;
+
+	struct Ctl {
+	    alignas(cmsghdr) char buf[CMSG_SPACE(sizeof(uint32_t))];
+	};
+	std::vector<Ctl> ctl;
+
+	void reset();
+	bool drops(unsigned i, uint32_t& n);
+    };
+
+    Batch::Batch(unsigned size)
+	: size(size),
+	  used(size),
+	  iov {&octet, 1},
+	  msg(size),
+	  ctl(size)
+    {
+	reset();
+    }
+
+    void Batch::reset()
+    {
+	for(unsigned i=0; i<used; i++) {
+	    msghdr& h = msg[i].msg_hdr;
+	    h = {};
+	    h.msg_iov = &iov;
+	    h.msg_iovlen = 1;
+	    h.msg_control = ctl[i].buf;
+	    h.msg_controllen = sizeof ctl[i].buf;
+	}
+	used = 0;
+    }
+
+    /**
+     * The socket's drop counter as of datagram 'i', if it came with
+     * one.  It only does once something has been dropped.  It's 32
+     * bits, and wraps.
+     */
+    bool Batch::drops(unsigned i, uint32_t& n)
+    {
+	msghdr& h = msg[i].msg_hdr;
+	for(cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+	    if(c->cmsg_level==SOL_SOCKET && c->cmsg_type==SO_RXQ_OVFL) {
+		std::memcpy(&n, CMSG_DATA(c), sizeof n);
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    /**
+     * One socket, and what has been found there.  The counts have a
+     * single writer, the thread serving the socket, and are atomic
+     * only so that the control socket can be served from another
+     * thread.  'ovfl' is the latest SO_RXQ_OVFL value, and 'drops'
+     * adds up its increases, so that it doesn't wrap.
+     *
+     * With --threads there's one socket per CPU, all sharing the
+     * port with SO_REUSEPORT, and each with SO_INCOMING_CPU set to
+     * its CPU.  Then the kernel (Linux 6.2 and later) queues a
+     * datagram to the socket for the CPU which handled it in
+     * softirq, so the counts are per CPU, and show how well RSS or
+     * RPS spreads the load.
+     */
+    struct alignas(64) Sink {
+	int fd = -1;
+	int cpu = -1;
+	std::atomic<uint64_t> packets {0};
+	std::atomic<uint64_t> octets {0};
+	std::atomic<uint64_t> drops {0};
+	uint32_t ovfl = 0;
+    };
+
+    /**
+     * One thread, pinned to 'cpu' unless it's -1, and the sockets it
+     * serves: with --threads, the one for its own CPU, and its share
+     * of the ones for CPUs no thread runs on.
+     */
+    struct Worker {
+	int cpu = -1;
+	std::vector<Sink*> sinks;
+	uint64_t nreads = 0;
+	uint64_t nwaits = 0;
+    };
+
+    void add(std::atomic<uint64_t>& a, uint64_t n)
+    {
+	a.store(a.load(std::memory_order_relaxed) + n,
+		std::memory_order_relaxed);
+    }
+
+    Counts sum(const std::vector<Sink>& sinks)
+    {
+	Counts c;
+	for(const Sink& s : sinks) {
+	    c.packets += s.packets.load(std::memory_order_relaxed);
+	    c.octets += s.octets.load(std::memory_order_relaxed);
+	    c.drops += s.drops.load(std::memory_order_relaxed);
+	}
+	return c;
+    }
+
+    /**
+     * True if we're running on Linux 'major'.'minor' or later.
+     */
+    bool linux_at_least(const unsigned major, const unsigned minor)
+    {
+	utsname u;
+	unsigned a;
+	unsigned b;
+	if(uname(&u) || std::sscanf(u.release, "%u.%u", &a, &b) != 2) {
+	    return false;
+	}
+	return a > major || (a==major && b >= minor);
+    }
+
+    /**
+     * Drain a socket, a batch at a time.  A short batch means it's
+     * empty, and saves us the EAGAIN.  Other errors are reported,
+     * and we leave the socket for now.  Returns the number of
+     * datagrams.
+     */
+    uint64_t drain(Sink& s, Batch& b, uint64_t& nreads)
+    {
+	uint64_t n = 0;
+	for(;;) {
+	    b.reset();
+	    const int k = recvmmsg(s.fd, b.msg.data(), b.size,
+				   MSG_DONTWAIT | MSG_TRUNC, 0);
+	    ++nreads;
+	    if(k==-1) {
+		if(errno!=EWOULDBLOCK && errno!=EINTR) {
+		    std::cerr << "warning: recvmmsg: "
+			      << strerror(errno) << '\n';
+		}
+		break;
+	    }
+	    b.used = k;
+
+	    uint64_t octets = 0;
+	    for(int j=0; j<k; j++) octets += b.msg[j].msg_len;
+	    n += k;
+	    add(s.packets, k);
+	    add(s.octets, octets);
+
+	    for(int j=k-1; j>=0; j--) {
+		uint32_t ovfl;
+		if(b.drops(j, ovfl)) {
+		    /* modulo 2^32, in case it wrapped */
+		    add(s.drops, uint32_t(ovfl - s.ovfl));
+		    s.ovfl = ovfl;
+		    break;
+		}
+	    }
+	    if(unsigned(k) < b.size) break;
+	}
+	return n;
+    }
+
+    /**
+     * One worker's loop, until 'done', or until it has seen 'limit'
+     * datagrams unless that's 0.  The control socket 'cfd' is served
+     * here too unless it's -1.  With --threads, the control socket
+     * and the -n limit are the main thread's job, and the workers
+     * wake up every 'timeout' ms to see if it's time to quit.
+     */
+    void serve(Worker& w, const Options& opt,
+	       const std::vector<Sink>& sinks,
+	       const int cfd, const uint64_t limit, const int timeout,
+	       std::atomic<bool>& done)
+    {
+	pin_thread(w.cpu);
+
+	const int efd = epoll_create1(0);
+	assert(efd!=-1);
+	for(unsigned i=0; i<w.sinks.size(); i++) {
+	    epoll_add(efd, w.sinks[i]->fd, i);
+	}
+	const unsigned control = w.sinks.size();
+	if(cfd!=-1) epoll_add(efd, cfd, control);
+
+	Counts baseline;
+	Batch b(opt.batch);
+	std::vector<epoll_event> ev(control + 1);
+	uint64_t seen = 0;
+
+	while(!done.load(std::memory_order_relaxed)) {
+
+	    const int n = epoll_wait(efd, ev.data(), ev.size(), timeout);
+	    ++w.nwaits;
+	    if(n==-1 && errno==EINTR) continue;
+	    assert(n>=0);
+
+	    for(int i=0; i<n; i++) {
+		const unsigned index = ev[i].data.u32;
+		if(index==control) {
+		    if(!controlmsg(cfd, sum(sinks), baseline)) done = true;
+		    continue;
+		}
+		seen += drain(*w.sinks[index], b, w.nreads);
+	    }
+
+	    if(limit && seen >= limit) done = true;
+	}
+
+	close(efd);
+    }
+
+    /**
+     * The final report, to stderr: per thread (if there are several),
+     * in total, and per socket.  If the kernel 'steered' datagrams
+     * by SO_INCOMING_CPU, that's per softirq CPU.
+     */
+    void report(const std::vector<Worker>& workers,
+		const std::vector<Sink>& sinks, const bool steered)
+    {
+	using ull = unsigned long long;
+	char buf[300];
+	uint64_t nreads = 0;
+	uint64_t nwaits = 0;
+
+	for(unsigned i=0; i<workers.size(); i++) {
+	    const Worker& w = workers[i];
+	    nreads += w.nreads;
+	    nwaits += w.nwaits;
+	    if(workers.size() < 2) continue;
+
+	    uint64_t packets = 0;
+	    for(const Sink* s : w.sinks) packets += s->packets.load();
+	    std::snprintf(buf, sizeof buf,
+			  "thread %u on cpu %d: %llu datagrams via "
+			  "%llu recvmmsg(2) and %llu epoll_wait(2) calls\n",
+			  i, w.cpu,
+			  static_cast<ull>(packets),
+			  static_cast<ull>(w.nreads),
+			  static_cast<ull>(w.nwaits));
+	    std::cerr << buf;
+	}
+
+	const Counts counts = sum(sinks);
+	std::snprintf(buf, sizeof buf,
+		      "%llu datagrams, %llu octets found via %llu recvmmsg(2) "
+		      "and %llu epoll_wait(2) calls; %.1f datagrams per call\n"
+		      "%llu dropped by the kernel\n",
+		      static_cast<ull>(counts.packets),
+		      static_cast<ull>(counts.octets),
+		      static_cast<ull>(nreads),
+		      static_cast<ull>(nwaits),
+		      double(counts.packets) / std::max<uint64_t>(1, nreads + nwaits),
+		      static_cast<ull>(counts.drops));
+	std::cerr << buf;
+
+	for(const Sink& s : sinks) {
+	    if(s.cpu==-1 || !s.packets.load()) continue;
+	    std::snprintf(buf, sizeof buf,
+			  "%s %d: %llu datagrams (%.1f%%), "
+			  "%llu dropped\n",
+			  steered ? "softirq on cpu" : "socket",
+			  s.cpu, static_cast<ull>(s.packets.load()),
+			  100.0 * s.packets.load() / counts.packets,
+			  static_cast<ull>(s.drops.load()));
+	    std::cerr << buf;
+	}
+    }
+
     int udpdiscard(const std::string& host,
 		   const std::string& port,
-		   const unsigned maxpackets,
-		   const bool nonblocking)
+		   const Options& opt)
     {
-	const int fd = udpserver(host, port, nonblocking);
-	if(fd == -1) {
+	const bool threaded = opt.threads > 0;
+	const unsigned nworkers = std::max(opt.threads, 1u);
+	std::vector<int> cpu;
+	if(!placement(cpu, nworkers, opt.cpu, threaded)) {
+	    std::cerr << "error: cpu " << opt.cpu << " is not available\n";
 	    return 1;
 	}
 
-	fd_set fds;
-	FD_ZERO(&fds);
+	std::vector<Worker> workers(nworkers);
+	for(unsigned i=0; i<workers.size(); i++) {
+	    workers[i].cpu = cpu[i];
+	}
 
-	unsigned npackets = 0;
-	unsigned nselects = 0;
-	unsigned nreads = 0;
+	/* Softirq may run on any CPU, not just the ones we may use,
+	 * so that's one socket for each CPU there is.  Before Linux
+	 * 6.2, SO_REUSEPORT ignores SO_INCOMING_CPU for UDP and picks
+	 * a socket by flow hash, so then the sockets are just sockets.
+	 */
+	const bool steered = threaded && linux_at_least(6, 2);
+	if(threaded && !steered) {
+	    std::cerr << "warning: this kernel predates Linux 6.2, and spreads"
+		      << " datagrams over the sockets by flow hash;"
+		      << " counts are per socket, not per softirq CPU\n";
+	}
+	const long ncpu = threaded ? sysconf(_SC_NPROCESSORS_CONF) : 1;
+	std::vector<Sink> sinks(std::max(ncpu, 1l));
+	unsigned spare = 0;
+	for(unsigned i=0; i<sinks.size(); i++) {
+	    Sink& s = sinks[i];
+	    const bool once = i==0;
 
-	while(maxpackets && npackets < maxpackets) {
+	    s.fd = udpserver(host, port, true, threaded, !once);
+	    if(s.fd == -1) {
+		return 1;
+	    }
 
-	    FD_SET(fd, &fds);
+	    const int one = 1;
+	    if(setsockopt(s.fd, SOL_SOCKET, SO_RXQ_OVFL,
+			  &one, sizeof one) && once) {
+		std::cerr << "warning: cannot enable SO_RXQ_OVFL: "
+			  << strerror(errno) << '\n';
+	    }
+	    if(opt.rcvbuf) {
+		const int granted = rcvbuf(s.fd, opt.rcvbuf);
+		if(once) {
+		    std::cout << "receive buffer: " << granted << " octets\n";
+		}
+	    }
 
-	    int rc = select(fd+1, &fds, 0, 0, 0);
-	    ++nselects;
-	    if(rc==-1 && errno==EINTR) continue;
-	    assert(rc!=-1);
-	    assert(rc==1);
-	    assert(FD_ISSET(fd, &fds));
+	    if(threaded) {
+		const int c = i;
+		if(setsockopt(s.fd, SOL_SOCKET, SO_INCOMING_CPU,
+			      &c, sizeof c)) {
+		    std::cerr << "error: cannot set SO_INCOMING_CPU: "
+			      << strerror(errno) << '\n';
+		    return 1;
+		}
+		s.cpu = c;
+	    }
 
-	    do {
-		/* just read the first octet and ditch the rest  */
-		char buf[1];
-		ssize_t nb = recv(fd, buf, sizeof buf, 0);
-		++nreads;
-		if(nb==-1) {
-		    assert(errno==EWOULDBLOCK);
-		    break;
+	    /* to the worker on the same CPU, if there is one */
+	    auto w = std::find_if(workers.begin(), workers.end(),
+				  [&s] (const Worker& x) {
+				      return s.cpu!=-1 && x.cpu==s.cpu;
+				  });
+	    if(w==workers.end()) w = workers.begin() + spare++ % workers.size();
+	    w->sinks.push_back(&s);
+	}
+
+	int cfd = -1;
+	if(!opt.control.empty()) {
+	    cfd = udpserver(host, opt.control, true);
+	    if(cfd == -1) {
+		return 1;
+	    }
+	}
+
+	std::atomic<bool> done {false};
+
+	if(!threaded) {
+	    serve(workers.front(), opt, sinks, cfd, opt.npackets, -1, done);
+	}
+	else {
+	    std::vector<std::thread> threads;
+	    for(Worker& w : workers) {
+		threads.push_back(std::thread(serve, std::ref(w), std::cref(opt),
+					      std::cref(sinks), -1, 0, 100,
+					      std::ref(done)));
+	    }
+
+	    /* The workers never look at each other's counts; -n is
+	     * checked here, every 100 ms, so it may be overshot a bit.
+	     */
+	    Counts baseline;
+	    while(!done) {
+		pollfd pfd = { cfd, POLLIN, 0 };
+		if(poll(&pfd, cfd!=-1, 100) == 1) {
+		    if(!controlmsg(cfd, sum(sinks), baseline)) done = true;
+		}
+		if(opt.npackets && sum(sinks).packets >= opt.npackets) {
+		    done = true;
 		}
-		assert(nb==1);
-		++npackets;
-	    } while(nonblocking);
+	    }
+
+	    for(std::thread& t : threads) t.join();
 	}
 
-	std::cerr << npackets << " datagrams found via "
-		  << nreads << " read(2) calls, "
-		  << nselects << " select(2) calls\n";
+	report(workers, sinks, steered);
 
-	return close(fd);
+	if(cfd!=-1) close(cfd);
+	int rc = 0;
+	for(const Sink& s : sinks) rc |= close(s.fd);
+	return rc;
     }
 }
 
@@ -134,28 +604,63 @@ int main(int argc, char ** argv)
     const string prog = argv[0];
     const string usage = string("usage: ")
 	+ prog
-	+ " [-n packets] [-N] host port";
-    const char optstring[] = "+n:N";
+	+ " [-n packets] [-c control-port] [--batch N] [--rcvbuf octets]"
+	+ " [--threads N] [--cpu N]"
+	+ " host port";
+    const char optstring[] = "+n:Nc:";
     struct option long_options[] = {
 	{"packets", 0, 0, 'p'},
 	{"nonblocking", 0, 0, 'N'},
+	{"control", 1, 0, 'c'},
+	{"batch", 1, 0, 'B'},
+	{"rcvbuf", 1, 0, 'R'},
+	{"threads", 1, 0, 'T'},
+	{"cpu", 1, 0, 'U'},
 	{"version", 0, 0, 'v'},
 	{"help", 0, 0, 'h'},
 	{0, 0, 0, 0}
     };
 
-    unsigned npackets = 1000000;
-    bool nonblocking = false;
+    Options opt;
+    bool limited = false;
 
     int ch;
     while((ch = getopt_long(argc, argv,
 			    optstring, &long_options[0], 0)) != -1) {
 	switch(ch) {
 	case 'n':
-	    npackets = std::atol(optarg);
+	    opt.npackets = std::strtoull(optarg, 0, 10);
+	    limited = true;
 	    break;
 	case 'N':
-	    nonblocking = true;
+	    /* always, these days */
+	    break;
+	case 'c':
+	    opt.control = optarg;
+	    break;
+	case 'B':
+	    opt.batch = std::strtoul(optarg, 0, 10);
+	    if(opt.batch < 1 || opt.batch > 1024) {
+		std::cerr << "error: the batch size must be 1--1024\n";
+		return 1;
+	    }
+	    break;
+	case 'R':
+	    opt.rcvbuf = std::strtol(optarg, 0, 10);
+	    break;
+	case 'T':
+	    {
+		char* end;
+		const unsigned long n = std::strtoul(optarg, &end, 10);
+		if(end==optarg || *end || optarg[0]=='-' || n > 1024) {
+		    std::cerr << "error: the number of threads must be 0--1024\n";
+		    return 1;
+		}
+		opt.threads = n;
+	    }
+	    break;
+	case 'U':
+	    opt.cpu = std::strtol(optarg, 0, 10);
 	    break;
 	case 'h':
 	    std::cout << usage << '\n';
@@ -183,5 +688,10 @@ int main(int argc, char ** argv)
     const string host = argv[optind++];
     const string port = argv[optind++];
 
-    return udpdiscard(host, port, npackets, nonblocking);
+    /* with a control socket, run until told to quit */
+    if(!opt.control.empty() && !limited) {
+	opt.npackets = 0;
+    }
+
+    return udpdiscard(host, port, opt);
 }
@@ -7,6 +7,11 @@
  */
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
 #include <iostream>
 #include <ostream>
 #include <sstream>
@@ -14,30 +19,81 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <ctime>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#include "uring.h"
+#include "peers.h"
+#include "portrange.h"
+#include "affinity.h"
+#include "rcvbuf.h"
 
 #ifdef MSG_WAITFORONE
 /* recvmmsg(2); Linux-specific and recent */
 #define HAS_MMSG
 #endif
 
+#ifndef SO_PREFER_BUSY_POLL
+/* Linux 5.11, but not yet in all libc headers */
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
 namespace {
 
+    /**
+     * The command-line options, except the sockets themselves.
+     */
+    struct Options {
+	bool verbose = false;
+	std::string control;
+	unsigned threads = 0;
+	unsigned batch = 5;
+	unsigned events = 64;
+	unsigned drain = 4;
+	size_t maxsize = 10000;
+	bool uring = false;
+	bool gro = false;
+	int rcvbuf = 0;
+	unsigned peers = 1024;
+	double limit = 0;
+	unsigned burst = 0;
+	uint64_t tick = 0;
+	bool busy = false;
+	unsigned budget = 0;
+	int cpu = -1;
+	int stamp = -1;
+    };
+
+    /* The largest control message, and the largest buffer UDP_GRO
+     * may coalesce a burst into.  The largest datagram we reflect is
+     * Options::maxsize.
+     */
+    const size_t maxdgram = 10000;
+    const size_t maxgro = 65535;
+
     /**
      * Parse a local address specification. The format goes:
      * - host:port
      * - port
      * It turns out that this is enough to support even numerical IPv6
-     * addresses and host/service names.
+     * addresses and host/service names.  The port may also be a
+     * range; see port_range().
      */
     void host_and_port(const char* s,
 		       std::string& host, std::string& port)
@@ -53,21 +109,46 @@ namespace {
 	    port = s;
 	}
     }
+
+    /**
+     * Remove a trailing "/weight" from a socket specification, and
+     * return the weight: 1 if there is none, 0 if it's not a positive
+     * number.
+     */
+    unsigned weight_of(std::string& s)
+    {
+	const size_t n = s.rfind('/');
+	if(n==std::string::npos) return 1;
+
+	const char* p = s.c_str() + n + 1;
+	char* end;
+	const unsigned long w = std::strtoul(p, &end, 10);
+	s.resize(n);
+	if(end==p || *end || w > 1000) return 0;
+	return w;
+    }
 }
 
 
 /**
  * Wrapper for getaddrinfo() for the UDP server case.
+ *
+ * If the name is a port range, 'first' and 'last' are set, and the
+ * address is only looked up once, for the first port.  Otherwise
+ * they are both 0.
  */
 struct Addrinfo {
     explicit Addrinfo(const std::string& name);
     ~Addrinfo();
 
     const std::string name;
+    std::string host;
+    unsigned first;
+    unsigned last;
     int err;
     const char* strerror() const { return gai_strerror(err); }
 
-    int socket() const;
+    int socket(bool reuseport = false, unsigned port = 0) const;
 
 private:
     addrinfo* ai;
@@ -79,6 +160,8 @@ private:
 
 Addrinfo::Addrinfo(const std::string& name)
     : name(name),
+      first(0),
+      last(0),
       err(0),
       ai(0)
 {
@@ -89,9 +172,11 @@ Addrinfo::Addrinfo(const std::string& name)
 	0,
 	0, 0, 0, 0 };
 
-    std::string host;
     std::string port;
     host_and_port(name.c_str(), host, port);
+    if(port_range(port, first, last)) {
+	port = std::to_string(first);
+    }
 
     err = getaddrinfo(host.empty()? 0: host.c_str(),
 		      port.c_str(),
@@ -110,8 +195,12 @@ Addrinfo::~Addrinfo()
  * Create a suitable socket (bound, UDP) from this info, or return -1.
  * and set errno.  Undefined results if err is already set.
  *
+ * With 'reuseport', SO_REUSEPORT is set before binding, so that
+ * several sockets can share the address and have the kernel spread
+ * the load between them.  A nonzero 'port' replaces the one which
+ * was looked up.
  */
-int Addrinfo::socket() const
+int Addrinfo::socket(bool reuseport, unsigned port) const
 {
     assert(!err);
 
@@ -121,8 +210,26 @@ int Addrinfo::socket() const
 	fd = ::socket(i->ai_family,
 		      i->ai_socktype,
 		      i->ai_protocol);
+	if(fd!=-1 && reuseport) {
+	    const int one = 1;
+	    int err = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+				 &one, sizeof one);
+	    if(err) {
+		close(fd);
+		fd = -1;
+	    }
+	}
 	if(fd!=-1) {
-	    int err = bind(fd, i->ai_addr, i->ai_addrlen);
+	    sockaddr_storage sa;
+	    std::memcpy(&sa, i->ai_addr, i->ai_addrlen);
+	    if(port && sa.ss_family==AF_INET) {
+		reinterpret_cast<sockaddr_in&>(sa).sin_port = htons(port);
+	    }
+	    if(port && sa.ss_family==AF_INET6) {
+		reinterpret_cast<sockaddr_in6&>(sa).sin6_port = htons(port);
+	    }
+	    int err = bind(fd, reinterpret_cast<sockaddr*>(&sa),
+			   i->ai_addrlen);
 	    if(err) {
 		close(fd);
 		fd = -1;
@@ -137,18 +244,32 @@ int Addrinfo::socket() const
 
 /**
  * Wrapper for simple counters.
+ *
+ * There's only ever one thread updating a counter, but the control
+ * socket may be served by another thread, hence the atomic.  The
+ * update is a relaxed load and store rather than a read-modify-write,
+ * so it costs no more than a plain increment.
  */
 template<class T>
 class Accumulator {
 public:
     Accumulator() : val(0) {}
-    Accumulator operator++ () { val++; return *this; }
-    Accumulator operator+= (unsigned n) { val+=n; return *this; }
+    Accumulator(const Accumulator& other) : val(other.get()) {}
+    Accumulator& operator++ () { return *this += 1; }
+    Accumulator& operator+= (T n) {
+	val.store(get() + n, std::memory_order_relaxed);
+	return *this;
+    }
+    Accumulator& operator+= (const Accumulator& other) {
+	return *this += other.get();
+    }
+
+    T get() const { return val.load(std::memory_order_relaxed); }
 
     std::ostream& rjust(std::ostream& os, int width) const {
-	char buf[20];
-	if(val) {
-	    std::sprintf(buf, "%*u", width, val);
+	char buf[30];
+	if(get()) {
+	    std::sprintf(buf, "%*llu", width, (unsigned long long)get());
 	}
 	else {
 	    std::sprintf(buf, "%*s", width, "");
@@ -157,39 +278,89 @@ public:
     }
 
 private:
-    T val;
+    std::atomic<T> val;
+    Accumulator& operator= (const Accumulator&);
 };
 
 
 /**
  * The state for a certain echo socket.
+ *
+ * Its 'weight' scales the number of batches it may handle per turn
+ * of the event loop.  Each time it's served after having been
+ * reported readable (or after having had its turn without being
+ * drained) counts as a wait, and 'waited' is the total time in ns
+ * spent waiting: from when it went on the ready list (the return of
+ * epoll_wait(2), or the end of the turn which put it back) to when
+ * its service starts.  The clock is read once per endpoint served,
+ * not per datagram.
+ *
+ * With --timestamp, 'stamp' is the payload offset to write
+ * timestamps at, and 'seq' the sequence number to write next;
+ * otherwise 'stamp' is -1.
+ *
+ * 'ovfl' is the latest SO_RXQ_OVFL value.  It's a 32-bit counter
+ * which wraps, so 'drop' grows by the difference, modulo 2^32.
  */
 struct Endpoint {
-    Endpoint(const std::string& name, int fd)
+    Endpoint(const std::string& name, int fd, unsigned weight = 1)
 	: name(name),
-	  fd(fd)
+	  fd(fd),
+	  weight(weight)
     {}
 
     std::string name;
     int fd;
-    Accumulator<unsigned> rx;
-    Accumulator<unsigned> tx;
-    Accumulator<unsigned> err;
-    Accumulator<unsigned long> rxb;
+    unsigned weight;
+    int stamp = -1;
+    uint32_t seq = 0;
+    uint32_t ovfl = 0;
+    Accumulator<uint64_t> rx;
+    Accumulator<uint64_t> tx;
+    Accumulator<uint64_t> err;
+    Accumulator<uint64_t> drop;
+    Accumulator<uint64_t> limited;
+    Accumulator<uint64_t> rxb;
+    Accumulator<uint64_t> waits;
+    Accumulator<uint64_t> waited;
 };
 
 
-std::ostream& operator<< (std::ostream& os, const std::vector<Endpoint>& val)
+/**
+ * The mean of 'waited' over 'waits', in us, right-justified in
+ * 'width' and left blank if there's nothing to say.
+ */
+std::ostream& wait_us(std::ostream& os, uint64_t waits, uint64_t waited,
+		      int width)
 {
-    os << "     rx      tx   err fd\n";
-    for(std::vector<Endpoint>::const_iterator i = val.begin();
-	i != val.end();
-	i++) {
-	const Endpoint& ep = *i;
+    char buf[40];
+    if(waits) {
+	std::sprintf(buf, "%*.1f", width, waited / 1e3 / waits);
+    }
+    else {
+	std::sprintf(buf, "%*s", width, "");
+    }
+    return os << buf;
+}
+
+
+/**
+ * The statistics table for endpoints [first, last) of 'val'.
+ */
+std::ostream& table(std::ostream& os, const std::vector<Endpoint>& val,
+		    unsigned first, unsigned last)
+{
+    os << "     rx      tx   err  drop   lim        rxb   wait fd\n";
+    for(unsigned i=first; i<last; i++) {
+	const Endpoint& ep = val[i];
 	ep.rx.rjust(os, 7) << ' ';
 	ep.tx.rjust(os, 7) << ' ';
 	ep.err.rjust(os, 5) << ' ';
-	char fd[5];
+	ep.drop.rjust(os, 5) << ' ';
+	ep.limited.rjust(os, 5) << ' ';
+	ep.rxb.rjust(os, 10) << ' ';
+	wait_us(os, ep.waits.get(), ep.waited.get(), 6) << ' ';
+	char fd[12];
 	std::sprintf(fd, "%2d", ep.fd);
 	os << fd << " " << ep.name << '\n';
     }
@@ -197,12 +368,444 @@ std::ostream& operator<< (std::ostream& os, const std::vector<Endpoint>& val)
 }
 
 
+std::ostream& operator<< (std::ostream& os, const std::vector<Endpoint>& val)
+{
+    return table(os, val, 0, val.size());
+}
+
+
+/**
+ * One thread's share of the work: its own socket for each
+ * [host:]port, its own epoll instance and its own counters.  Unless
+ * --threads is used, there's just one of these, and the control
+ * socket is served from the same loop.
+ *
+ * The peer table (if any) is guarded by 'lock', which the worker
+ * holds while it handles a batch.  The rate limit (if any) has its
+ * own table, 'sources', keyed on the address alone: a sender
+ * shouldn't get more by using more ports.  'now' is the worker's idea of the
+ * time (CLOCK_MONOTONIC_COARSE, in ns), updated once per batch.
+ *
+ * With --busy-poll, 'rounds' counts the rounds over all endpoints,
+ * 'idle' the ones which found nothing, and 'sleeps' the times the
+ * worker gave up and went to sleep in epoll_wait(2).
+ */
+struct Worker {
+    Worker(int efd, int cpu, unsigned npeers, bool limited)
+	: efd(efd),
+	  cpu(cpu),
+	  lock(new std::mutex),
+	  peers(npeers ? new Peers(npeers) : nullptr),
+	  sources(limited ? new Peers(npeers) : nullptr),
+	  now(0)
+    {}
+
+    int efd;
+    int cpu;
+    std::vector<Endpoint> ep;
+    std::unique_ptr<std::mutex> lock;
+    std::unique_ptr<Peers> peers;
+    std::unique_ptr<Peers> sources;
+    uint64_t now;
+    Accumulator<uint64_t> rounds;
+    Accumulator<uint64_t> idle;
+    Accumulator<uint64_t> sleeps;
+};
+
+
+/**
+ * A monotonic clock with a resolution of a few milliseconds, but
+ * cheap enough to read once per batch of datagrams.  For finer
+ * timing there's fine().
+ */
+uint64_t coarse()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * How often coarse() moves, in ns.
+ */
+uint64_t coarse_tick()
+{
+    timespec ts;
+    if(clock_getres(CLOCK_MONOTONIC_COARSE, &ts)) return 0;
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t fine()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/**
+ * The statistics summed over all workers, per [host:]port.
+ * The fds are meaningless here, so they're shown as -1.
+ */
+std::vector<Endpoint> total(const std::vector<Worker>& workers)
+{
+    std::vector<Endpoint> acc;
+    for(const Endpoint& ep : workers.front().ep) {
+	acc.push_back(Endpoint(ep.name, -1, ep.weight));
+    }
+    for(const Worker& w : workers) {
+	for(unsigned i=0; i<acc.size(); i++) {
+	    acc[i].rx += w.ep[i].rx;
+	    acc[i].tx += w.ep[i].tx;
+	    acc[i].err += w.ep[i].err;
+	    acc[i].drop += w.ep[i].drop;
+	    acc[i].limited += w.ep[i].limited;
+	    acc[i].rxb += w.ep[i].rxb;
+	    acc[i].waits += w.ep[i].waits;
+	    acc[i].waited += w.ep[i].waited;
+	}
+    }
+    return acc;
+}
+
+
+/**
+ * The --busy-poll statistics of a worker, if there are any.
+ */
+std::ostream& busy(std::ostream& os, const Worker& w)
+{
+    const uint64_t rounds = w.rounds.get();
+    if(!rounds) return os;
+
+    char buf[100];
+    std::sprintf(buf, "busy poll: %llu rounds, %.1f%% idle, %llu sleeps\n",
+		 (unsigned long long)rounds,
+		 100.0 * w.idle.get() / rounds,
+		 (unsigned long long)w.sleeps.get());
+    return os << buf;
+}
+
+
+/**
+ * The 's' statistics for endpoints [first, last), per worker if
+ * there's more than one, and then in total.
+ */
+std::ostream& show(std::ostream& os, const std::vector<Worker>& val,
+		   unsigned first, unsigned last)
+{
+    if(val.size()==1) {
+	table(os, val.front().ep, first, last);
+	return busy(os, val.front());
+    }
+
+    for(unsigned i=0; i<val.size(); i++) {
+	os << "worker " << i << ", cpu " << val[i].cpu << ":\n";
+	table(os, val[i].ep, first, last);
+	busy(os, val[i]) << '\n';
+    }
+    os << "total:\n";
+    return table(os, total(val), first, last);
+}
+
+
+std::ostream& operator<< (std::ostream& os, const std::vector<Worker>& val)
+{
+    return show(os, val, 0, val.front().ep.size());
+}
+
+
+/**
+ * A control reply about endpoints [first, n) which may not fit in
+ * one datagram.  It's rendered by f(first, last) for the largest
+ * 'last' which fits in 'size' octets, but always at least one
+ * endpoint.  It's up to f to say where the next page starts when
+ * last < n; the client then asks again from there.
+ */
+template <class F>
+std::string paged(unsigned first, unsigned n, size_t size, F f)
+{
+    if(first >= n) return f(n, n);
+
+    unsigned last = first + 1;
+    std::string s = f(first, last);
+
+    /* gallop, then bisect */
+    unsigned step = 1;
+    bool growing = true;
+    while(step && last < n) {
+	const unsigned next = std::min(n, last + step);
+	std::string t = f(first, next);
+	if(t.size() <= size) {
+	    s.swap(t);
+	    last = next;
+	    if(growing) step *= 2;
+	    else step /= 2;
+	}
+	else {
+	    growing = false;
+	    step /= 2;
+	}
+    }
+    return s;
+}
+
+
+/**
+ * An endpoint's counters at one point in time, or the difference
+ * between two such points.
+ */
+struct Counters {
+    Counters() = default;
+    explicit Counters(const Endpoint& ep)
+	: rx(ep.rx.get()),
+	  tx(ep.tx.get()),
+	  err(ep.err.get()),
+	  drop(ep.drop.get()),
+	  limited(ep.limited.get()),
+	  rxb(ep.rxb.get()),
+	  waits(ep.waits.get()),
+	  waited(ep.waited.get())
+    {}
+
+    Counters operator- (const Counters& other) const {
+	Counters c;
+	c.rx = rx - other.rx;
+	c.tx = tx - other.tx;
+	c.err = err - other.err;
+	c.drop = drop - other.drop;
+	c.limited = limited - other.limited;
+	c.rxb = rxb - other.rxb;
+	c.waits = waits - other.waits;
+	c.waited = waited - other.waited;
+	return c;
+    }
+
+    uint64_t rx = 0;
+    uint64_t tx = 0;
+    uint64_t err = 0;
+    uint64_t drop = 0;
+    uint64_t limited = 0;
+    uint64_t rxb = 0;
+    uint64_t waits = 0;
+    uint64_t waited = 0;
+};
+
+
+/**
+ * The statistics as seen at one time (CLOCK_MONOTONIC), with
+ * per-endpoint totals.
+ */
+struct Snapshot {
+    Snapshot() : t(0) {}
+    explicit Snapshot(const std::vector<Worker>& workers);
+
+    double t;
+    std::vector<std::string> name;
+    std::vector<Counters> ep;
+};
+
+
+Snapshot::Snapshot(const std::vector<Worker>& workers)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t = ts.tv_sec + ts.tv_nsec * 1e-9;
+
+    for(const Endpoint& e : total(workers)) {
+	name.push_back(e.name);
+	ep.push_back(Counters(e));
+    }
+}
+
+
+/**
+ * The 'n' busiest peers across all workers, for the 'p' command.
+ */
+std::string top(const std::vector<Worker>& workers, unsigned n)
+{
+    std::vector<Peers::Peer> acc;
+    uint64_t evicted = 0;
+    for(const Worker& w : workers) {
+	if(!w.peers) continue;
+	std::lock_guard<std::mutex> guard(*w.lock);
+	evicted += w.peers->evicted;
+	for(const Peers::Peer& p : w.peers->top(n)) {
+	    auto same = [&p] (const Peers::Peer& q) { return q.key==p.key; };
+	    auto i = std::find_if(acc.begin(), acc.end(), same);
+	    if(i==acc.end()) {
+		acc.push_back(p);
+	    }
+	    else {
+		i->packets += p.packets;
+		i->octets += p.octets;
+		i->seen = std::max(i->seen, p.seen);
+	    }
+	}
+    }
+
+    std::sort(acc.begin(), acc.end(),
+	      [] (const Peers::Peer& a, const Peers::Peer& b) {
+		  return a.packets > b.packets;
+	      });
+    if(acc.size() > n) acc.resize(n);
+
+    const uint64_t now = coarse();
+    std::ostringstream os;
+    os << "   packets       octets     age peer\n";
+    for(const Peers::Peer& p : acc) {
+	char buf[60];
+	std::sprintf(buf, "%10llu %12llu %7.1f ",
+		     (unsigned long long)p.packets,
+		     (unsigned long long)p.octets,
+		     (now - std::min(now, p.seen)) * 1e-9);
+	os << buf << p.key.str() << '\n';
+    }
+    if(evicted) {
+	os << evicted << " peers evicted from the tables\n";
+    }
+    return os.str();
+}
+
+
+namespace json {
+
+    std::string quote(const std::string& s)
+    {
+	std::string acc = "\"";
+	for(char ch : s) {
+	    if(ch=='"' || ch=='\\') acc.push_back('\\');
+	    acc.push_back(ch);
+	}
+	return acc + '"';
+    }
+
+    std::ostream& operator<< (std::ostream& os, const Counters& c)
+    {
+	return os << "\"rx\": " << c.rx
+		  << ", \"tx\": " << c.tx
+		  << ", \"err\": " << c.err
+		  << ", \"drop\": " << c.drop
+		  << ", \"limited\": " << c.limited
+		  << ", \"rxb\": " << c.rxb
+		  << ", \"waits\": " << c.waits
+		  << ", \"waited_ns\": " << c.waited;
+    }
+
+    void time(std::ostream& os, const char* name, double t)
+    {
+	char buf[40];
+	std::sprintf(buf, "%.6f", t);
+	os << '"' << name << "\": " << buf;
+    }
+
+    /**
+     * Where the next page starts, if there is one.
+     */
+    void next(std::ostream& os, unsigned last, unsigned n)
+    {
+	if(last < n) os << ",\n \"next\": " << last;
+    }
+
+    /**
+     * The 'j' statistics for endpoints [first, last) out of 'now':
+     * a snapshot of the counters, with per-worker details if there's
+     * more than one.
+     */
+    std::string stats(const std::vector<Worker>& workers,
+		      const Snapshot& now,
+		      unsigned first, unsigned last)
+    {
+	std::ostringstream os;
+
+	os << '{';
+	time(os, "time", now.t);
+	os << ",\n \"endpoints\": [";
+	for(unsigned i=first; i<last; i++) {
+	    os << (i>first ? ",\n  {" : "\n  {")
+	       << "\"name\": " << quote(now.name[i]) << ", "
+	       << now.ep[i] << '}';
+	}
+	os << ']';
+
+	if(workers.size() > 1) {
+	    os << ",\n \"workers\": [";
+	    for(unsigned i=0; i<workers.size(); i++) {
+		const Worker& w = workers[i];
+		os << (i ? ",\n  {" : "\n  {")
+		   << "\"cpu\": " << w.cpu << ", \"endpoints\": [";
+		for(unsigned j=first; j<last; j++) {
+		    os << (j>first ? ",\n   {" : "\n   {")
+		       << "\"name\": " << quote(w.ep[j].name) << ", "
+		       << "\"fd\": " << w.ep[j].fd << ", "
+		       << Counters(w.ep[j]) << '}';
+		}
+		os << "]}";
+	    }
+	    os << ']';
+	}
+
+	uint64_t rounds = 0;
+	uint64_t idle = 0;
+	uint64_t sleeps = 0;
+	for(const Worker& w : workers) {
+	    rounds += w.rounds.get();
+	    idle += w.idle.get();
+	    sleeps += w.sleeps.get();
+	}
+	if(rounds) {
+	    os << ",\n \"busy\": {\"rounds\": " << rounds
+	       << ", \"idle\": " << idle
+	       << ", \"sleeps\": " << sleeps << '}';
+	}
+	next(os, last, now.ep.size());
+	os << "}\n";
+	return os.str();
+    }
+
+    /**
+     * The 'r' statistics for endpoints [first, last): what happened
+     * between the snapshots 'prev' and 'now', as counts and rates.
+     */
+    std::string rates(const Snapshot& now, const Snapshot& prev,
+		      unsigned first, unsigned last)
+    {
+	const double dt = now.t - prev.t;
+	const double hz = dt > 0 ? 1/dt : 0;
+	std::ostringstream os;
+
+	os << '{';
+	time(os, "time", now.t);
+	os << ", ";
+	time(os, "interval", dt);
+	os << ",\n \"endpoints\": [";
+	for(unsigned i=first; i<last; i++) {
+	    const Counters d = i < prev.ep.size()
+		? now.ep[i] - prev.ep[i]
+		: now.ep[i];
+	    char buf[150];
+	    std::sprintf(buf, "\"rx_pps\": %.1f, \"tx_pps\": %.1f, "
+			 "\"rx_bps\": %.0f, \"wait_us\": %.1f",
+			 d.rx * hz, d.tx * hz, d.rxb * 8 * hz,
+			 d.waits ? d.waited / 1e3 / d.waits : 0.0);
+	    os << (i>first ? ",\n  {" : "\n  {")
+	       << "\"name\": " << quote(now.name[i]) << ", "
+	       << d << ", " << buf << '}';
+	}
+	os << ']';
+	next(os, last, now.ep.size());
+	os << "}\n";
+	return os.str();
+    }
+}
+
+
 namespace {
 
-    void epoll_add(int efd, int fd, unsigned index)
+    void epoll_add(int efd, int fd, unsigned index,
+		   uint32_t events = EPOLLIN)
     {
 	struct epoll_event ev;
-	ev.events = EPOLLIN;
+	ev.events = events;
 	ev.data.u64 = 0; /* keep valgrind happy */
 	ev.data.u32 = index;
 	int err = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
@@ -212,28 +815,35 @@ namespace {
 
     /**
      * Just something to keep track of the bits & pieces
-     * needed for our struct msghdr.
+     * needed for our struct msghdr.  The payload buffer is
+     * someone else's, and attached before use.
      */
     struct Msg {
-	Msg() {
-	    iov.iov_base = buf;
-	    iov.iov_len = sizeof buf;
+	Msg() : buf(0), size(0) {}
+
+	void attach(char* p, size_t n) {
+	    buf = p;
+	    size = n;
 	}
 
 	msghdr hdr_of() {
+	    iov.iov_base = buf;
+	    iov.iov_len = size;
 	    msghdr h;
 	    h.msg_name = reinterpret_cast<void*>(&sa);
 	    h.msg_namelen = sizeof sa;
 	    h.msg_iov = &iov;
 	    h.msg_iovlen = 1;
-	    h.msg_control = 0;
-	    h.msg_controllen = 0;
+	    h.msg_control = ctl;
+	    h.msg_controllen = sizeof ctl;
 	    return h;
 	}
 
 	sockaddr_storage sa;
 	iovec iov;
-	char buf[10000];
+	char* buf;
+	size_t size;
+	alignas(cmsghdr) char ctl[128];
 
     private:
 	Msg(const Msg&);
@@ -247,36 +857,94 @@ namespace {
 	std::ostringstream oss;
 	oss << val;
 	const std::string s = oss.str();
-	std::copy(s.begin(), s.end(), msg.buf);
-	msg.iov.iov_len = s.size();
+	const size_t n = std::min(s.size(), msg.size);
+	std::copy(s.begin(), s.begin() + n, msg.buf);
+	msg.iov.iov_len = n;
     }
 
+    /* the previous 'r', or the start, and the one before that */
+    Snapshot baseline;
+    Snapshot rated;
+
     /**
      * Handle a message on the control socket, currently
      * q.* - quit
-     * s.* - show statistics
+     * s [N] - show statistics
+     * j [N] - show statistics, as JSON
+     * r [N] - show what happened since the last 'r', as JSON
+     * p [N] - show the N (10) busiest peers
      * Returning false is a request to exit.
+     *
+     * With many endpoints, 's', 'j' and 'r' don't fit in one
+     * datagram.  Then they cover as many endpoints as fit, ending
+     * with "more N" or "next": N, and "s N" (and so on) shows the
+     * rest from endpoint N.  A page is complete in itself, and the
+     * JSON is valid.  "r N" pages through the interval the latest
+     * plain 'r' (or "r 0") measured, rather than starting a new one.
      */
-    bool controlmsg(const int fd, const std::vector<Endpoint>& ep)
+    bool controlmsg(const int fd, const std::vector<Worker>& ep)
     {
+	static char buf[maxdgram];
 	static Msg msg;
+	msg.attach(buf, sizeof buf);
 	msghdr h = msg.hdr_of();
 
 	const ssize_t n = recvmsg(fd, &h, MSG_TRUNC);
+	if(n==-1 && errno==EAGAIN) {
+	    /* polled, and found nothing */
+	    return true;
+	}
 	if(n<1) {
 	    return false;
 	}
+	h.msg_controllen = 0;
 
 	const char cmd = msg.buf[0];
+	const size_t len = std::min(size_t(n), msg.size);
+	const std::string arg(msg.buf + 1, msg.buf + len);
+	const unsigned long N = std::strtoul(arg.c_str(), 0, 10);
+	const unsigned first = std::min<unsigned long>(N, ~0u);
+	const unsigned nep = ep.front().ep.size();
+
 	switch(cmd) {
 	case 's':
-	    msg << ep;
+	    msg << paged(first, nep, msg.size,
+			 [&ep, nep] (unsigned a, unsigned b) {
+			     std::ostringstream os;
+			     show(os, ep, a, b);
+			     if(b < nep) os << "more " << b << '\n';
+			     return os.str();
+			 });
+	    break;
+	case 'j':
+	    {
+		const Snapshot now(ep);
+		msg << paged(first, nep, msg.size,
+			     [&ep, &now] (unsigned a, unsigned b) {
+				 return json::stats(ep, now, a, b);
+			     });
+	    }
+	    break;
+	case 'r':
+	    if(!first) {
+		rated = baseline;
+		baseline = Snapshot(ep);
+	    }
+	    msg << paged(first, baseline.ep.size(), msg.size,
+			 [] (unsigned a, unsigned b) {
+			     return json::rates(baseline, rated, a, b);
+			 });
+	    break;
+	case 'p':
+	    msg << top(ep, N ? N : 10);
 	    break;
 	case 'q':
 	    msg << "Goodbye.\n";
 	    break;
 	default:
-	    msg << "Usage: s, statistics; q, quit\n";
+	    msg << "Usage: s [N], statistics; j [N], statistics as JSON;"
+		" r [N], rates since the last r; p [N], top N peers; q, quit\n"
+		"N is the endpoint to start from, when a reply didn't fit\n";
 	}
 
 	(void)sendmsg(fd, &h, MSG_DONTWAIT);
@@ -285,88 +953,756 @@ namespace {
     }
 
 
-    void reflect(Endpoint& ep,
-		 const msghdr& h,
-		 const unsigned len)
+    /**
+     * 'count' buffers of 'size' octets each, in one anonymous mapping
+     * made up front.  Pages nobody writes to never get allocated, and
+     * the kernel only writes the datagrams it receives; we only write
+     * (with --timestamp) within those.  So buffers sized for 64 KiB
+     * datagrams cost little when the datagrams are small.
+     *
+     * Buffers start on a cache line, but are staggered so they don't
+     * all start at the same offset in a page, and compete for the same
+     * few cache sets.
+     */
+    class Pool {
+    public:
+	Pool(unsigned count, size_t size);
+	~Pool() { munmap(mem, len); }
+
+	char* buf(unsigned n) const { return mem + n*stride; }
+	const size_t size;
+
+    private:
+	size_t stride;
+	size_t len;
+	char* mem;
+
+	Pool(const Pool&);
+	Pool& operator= (const Pool&);
+    };
+
+    Pool::Pool(unsigned count, size_t size)
+	: size(size),
+	  stride((size + 63) & ~size_t(63)),
+	  len(0),
+	  mem(nullptr)
+    {
+	if(stride % 4096 == 0) stride += 64;
+	len = count * stride;
+	void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(p==MAP_FAILED) throw std::bad_alloc();
+	mem = static_cast<char*>(p);
+    }
+
+
+    /**
+     * The receive buffers for one thread; up to 'size' datagrams
+     * of up to 'bufsize' octets are handled per system call.  Only
+     * the first 'used' headers have been touched by the kernel since
+     * they were last set up.  For each datagram to send, 'count' is
+     * the number of datagrams it represents.
+     */
+    struct Batch {
+	Batch(unsigned size, size_t bufsize)
+	    : size(size),
+	      used(size),
+	      pool(size, bufsize),
+	      msg(size),
+	      in(size),
+	      out(size),
+	      count(size)
+	{
+	    for(unsigned i=0; i<size; i++) {
+		msg[i].attach(pool.buf(i), bufsize);
+	    }
+	}
+
+	const unsigned size;
+	unsigned used;
+	Pool pool;
+	std::vector<Msg> msg;
+	std::vector<mmsghdr> in;
+	std::vector<mmsghdr> out;
+	std::vector<unsigned> count;
+    };
+
+
+    /**
+     * The ancillary data of a received datagram, or the parts of it
+     * we care about: the UDP_GRO segment size, the socket's
+     * SO_RXQ_OVFL drop counter, and the SO_TIMESTAMPNS receive time.
+     * The drop counter is only there once something has been
+     * dropped, and the time only if we asked for it.
+     */
+    struct Ancillary {
+	explicit Ancillary(msghdr& h);
+
+	int gro = 0;
+	bool ovfl = false;
+	uint32_t drops = 0;
+	timespec when = {};
+    };
+
+    Ancillary::Ancillary(msghdr& h)
+    {
+	for(cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+	    if(c->cmsg_level==IPPROTO_UDP && c->cmsg_type==UDP_GRO) {
+		std::memcpy(&gro, CMSG_DATA(c), sizeof gro);
+	    }
+	    else if(c->cmsg_level==SOL_SOCKET && c->cmsg_type==SO_RXQ_OVFL) {
+		std::memcpy(&drops, CMSG_DATA(c), sizeof drops);
+		ovfl = true;
+	    }
+	    else if(c->cmsg_level==SOL_SOCKET && c->cmsg_type==SCM_TIMESTAMPNS) {
+		std::memcpy(&when, CMSG_DATA(c), sizeof when);
+	    }
+	}
+    }
+
+
+    /**
+     * The number of datagrams in a received buffer of 'len' octets:
+     * more than one if UDP_GRO coalesced a burst from a peer.  The
+     * ancillary data is replaced with what it takes to send it back
+     * the same way: UDP_SEGMENT for a coalesced buffer, otherwise
+     * nothing.
+     */
+    unsigned segments(msghdr& h, const unsigned len, const int size)
+    {
+	if(size <= 0 || len <= unsigned(size)) {
+	    h.msg_control = 0;
+	    h.msg_controllen = 0;
+	    return 1;
+	}
+
+	const uint16_t gso = size;
+	h.msg_controllen = CMSG_SPACE(sizeof gso);
+	cmsghdr* c = CMSG_FIRSTHDR(&h);
+	c->cmsg_level = IPPROTO_UDP;
+	c->cmsg_type = UDP_SEGMENT;
+	c->cmsg_len = CMSG_LEN(sizeof gso);
+	std::memcpy(CMSG_DATA(c), &gso, sizeof gso);
+	return (len + size - 1) / size;
+    }
+
+
+    /**
+     * The --timestamp reflector mode.  Each reflected datagram which
+     * is long enough gets, at the endpoint's offset and in network
+     * byte order:
+     * - a 32-bit sequence number, counted per endpoint
+     * - the time the kernel received it (64-bit NTP format)
+     * - the time just before it was sent back (ditto)
+     * A coalesced UDP_GRO buffer gets this in each of its datagrams.
+     * The receive time is SO_TIMESTAMPNS; the send time is ours, since
+     * the kernel's is only known after the fact.
+     */
+    namespace stamp {
+
+	const unsigned size = 4 + 8 + 8;
+
+	uint64_t ntp(const timespec& ts)
+	{
+	    if(!ts.tv_sec) return 0;
+	    const uint64_t sec = ts.tv_sec + 2208988800ull;
+	    const uint64_t frac = (uint64_t(ts.tv_nsec) << 32) / 1000000000;
+	    return sec << 32 | frac;
+	}
+
+	uint64_t now()
+	{
+	    timespec ts;
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    return ntp(ts);
+	}
+
+	void put(char* p, uint64_t val, unsigned n)
+	{
+	    while(n--) {
+		p[n] = val & 0xff;
+		val >>= 8;
+	    }
+	}
+
+	/**
+	 * The size of each datagram in 'h', which has been through
+	 * segments().
+	 */
+	unsigned segment(const msghdr& h, const unsigned len)
+	{
+	    const cmsghdr* c = h.msg_controllen ? CMSG_FIRSTHDR(&h) : nullptr;
+	    if(!c || c->cmsg_type!=UDP_SEGMENT) return len;
+	    uint16_t gso;
+	    std::memcpy(&gso, CMSG_DATA(c), sizeof gso);
+	    return gso;
+	}
+
+	void rx(Endpoint& ep, const msghdr& h, const unsigned len,
+		const timespec& when)
+	{
+	    const uint64_t t = ntp(when);
+	    const unsigned size = segment(h, len);
+	    char* const buf = static_cast<char*>(h.msg_iov[0].iov_base);
+	    for(unsigned pos = 0; pos < len; pos += size) {
+		const unsigned n = std::min(size, len - pos);
+		if(n < ep.stamp + stamp::size) continue;
+		char* const p = buf + pos + ep.stamp;
+		put(p, ep.seq++, 4);
+		put(p + 4, t, 8);
+	    }
+	}
+
+	void tx(const Endpoint& ep, const msghdr& h, const uint64_t t)
+	{
+	    const unsigned len = h.msg_iov[0].iov_len;
+	    const unsigned size = segment(h, len);
+	    char* const buf = static_cast<char*>(h.msg_iov[0].iov_base);
+	    for(unsigned pos = 0; pos < len; pos += size) {
+		const unsigned n = std::min(size, len - pos);
+		if(n < ep.stamp + stamp::size) continue;
+		put(buf + pos + ep.stamp + 12, t, 8);
+	    }
+	}
+    }
+
+
+    /**
+     * Account for a received buffer, and return the number of
+     * datagrams in it which are fit for reflecting (none, or all).
+     * They're not if they're truncated, or if the source address is
+     * over its rate limit.  The caller holds the worker's lock.
+     *
+     * A source new to the table starts with an empty bucket rather
+     * than a full one; otherwise a sender which gets itself evicted
+     * (by churning through addresses) would get a fresh burst each
+     * time it comes back.
+     */
+    unsigned received(Worker& w,
+		      const Limit* limit,
+		      Endpoint& ep,
+		      msghdr& h,
+		      const unsigned len)
     {
-	++ep.rx;
+	const Ancillary anc(h);
+	if(anc.ovfl) {
+	    ep.drop += uint32_t(anc.drops - ep.ovfl);
+	    ep.ovfl = anc.drops;
+	}
+
+	const unsigned n = segments(h, len, anc.gro);
+	ep.rx += n;
 	ep.rxb += len;
 
+	const sockaddr& sa = *static_cast<const sockaddr*>(h.msg_name);
+	if(w.peers) {
+	    Peers::Peer& p = w.peers->lookup(Peers::key_of(sa), w.now);
+	    p.packets += n;
+	    p.octets += len;
+	}
+
+	bool admitted = true;
+	if(limit) {
+	    Peers::Peer& p = w.sources->lookup(Peers::addr_of(sa), w.now);
+	    if(!p.tat) p.tat = w.now + limit->tau;
+	    admitted = limit->admit(p.tat, w.now, n);
+	}
+
 	if(h.msg_flags & MSG_TRUNC) {
 	    /* truncation; treat as an error */
-	    ++ep.err;
+	    ep.err += n;
+	    return 0;
 	}
-	else {
-	    ssize_t n = sendmsg(ep.fd,
-				&h,
-				MSG_DONTWAIT);
-	    if(n==-1) {
-		++ep.err;
-	    }
-	    else {
-		++ep.tx;
-	    }
+	if(!admitted) {
+	    ep.limited += n;
+	    return 0;
 	}
+	if(ep.stamp >= 0) stamp::rx(ep, h, len, anc.when);
+	return n;
     }
 
 #ifdef HAS_MMSG
     /**
      * The (blocking) UDP socket has become readable, and we're
      * supposed to reflect at least /some/ of whatever is there, and
-     * update the statistics.
+     * update the statistics.  Or, with 'flags' MSG_DONTWAIT, we're
+     * polling it and it may not be readable at all.
+     *
+     * Everything fit for reflecting goes out with sendmmsg(2).  That
+     * one stops at the first failing datagram, which we count as an
+     * error and skip.
+     *
+     * Returns the number of datagrams received.
      */
-    void reflect(Endpoint& ep)
+    int reflect(Worker& w, const Limit* limit, Endpoint& ep, Batch& b,
+		const int flags = MSG_WAITFORONE)
     {
 	const int fd = ep.fd;
-	static Msg msg[5];
-	mmsghdr mm[5];
-	for(int i=0; i<5; i++) {
-	    mm[i].msg_hdr = msg[i].hdr_of();
+	for(unsigned i=0; i<b.used; i++) {
+	    b.in[i].msg_hdr = b.msg[i].hdr_of();
 	}
 
-	const int n = recvmmsg(fd, mm, 5, MSG_WAITFORONE | MSG_TRUNC, 0);
+	const int n = recvmmsg(fd, b.in.data(), b.size,
+			       flags | MSG_TRUNC, 0);
 	if(n==-1) {
-	    ++ep.err;
-	    return;
+	    b.used = 0;
+	    if(errno!=EAGAIN) ++ep.err;
+	    return 0;
 	}
+	b.used = n;
+
+	unsigned m = 0;
+	std::unique_lock<std::mutex> guard(*w.lock);
+	w.now = coarse();
 	for(int i=0; i<n; i++) {
-	    msghdr& h = mm[i].msg_hdr;
-	    unsigned len = mm[i].msg_len;
-	    h.msg_iov[0].iov_len = len;
-	    reflect(ep, h, len);
+	    msghdr& h = b.in[i].msg_hdr;
+	    unsigned len = b.in[i].msg_len;
+	    const unsigned count = received(w, limit, ep, h, len);
+	    if(count) {
+		h.msg_iov[0].iov_len = len;
+		b.count[m] = count;
+		b.out[m++].msg_hdr = h;
+	    }
+	}
+	guard.unlock();
+
+	if(ep.stamp >= 0) {
+	    const uint64_t t = stamp::now();
+	    for(unsigned j=0; j<m; j++) stamp::tx(ep, b.out[j].msg_hdr, t);
 	}
+
+	unsigned i = 0;
+	while(i < m) {
+	    const int k = sendmmsg(fd, &b.out[i], m - i, MSG_DONTWAIT);
+	    if(k==-1) {
+		ep.err += b.count[i];
+		i++;
+	    }
+	    else {
+		const unsigned end = i + k;
+		for(; i < end; i++) {
+		    ep.tx += b.count[i];
+		}
+	    }
+	}
+	return n;
     }
 #else
-    void reflect(Endpoint& ep)
+    int reflect(Worker& w, const Limit* limit, Endpoint& ep, Batch& b,
+		const int flags = 0)
     {
 	const int fd = ep.fd;
-	static Msg msg;
-	msghdr h = msg.hdr_of();
+	msghdr h = b.msg[0].hdr_of();
 
-	const ssize_t n = recvmsg(fd, &h, MSG_TRUNC);
+	const ssize_t n = recvmsg(fd, &h, flags | MSG_TRUNC);
 	if(n==-1) {
-	    ++ep.err;
-	    return;
+	    if(errno!=EAGAIN) ++ep.err;
+	    return 0;
 	}
 
 	unsigned len = n;
-	h.msg_iov[0].iov_len = len;
-	reflect(ep, h, len);
+	std::unique_lock<std::mutex> guard(*w.lock);
+	w.now = coarse();
+	const unsigned count = received(w, limit, ep, h, len);
+	guard.unlock();
+	if(count) {
+	    h.msg_iov[0].iov_len = len;
+	    if(ep.stamp >= 0) stamp::tx(ep, h, stamp::now());
+	    if(sendmsg(fd, &h, MSG_DONTWAIT)==-1) {
+		ep.err += count;
+	    }
+	    else {
+		ep.tx += count;
+	    }
+	}
+	return 1;
+    }
+#endif
+
+
+
+    /**
+     * The io_uring(7) event loop, an alternative to the epoll(7) one
+     * in serve().  Each endpoint has a multishot recvmsg armed, which
+     * picks buffers from a provided buffer ring.  A datagram is
+     * reflected with a sendmsg straight from the buffer it arrived
+     * in, and the buffer is recycled when that completes.
+     *
+     * Returns false if the kernel lacks something we need; then
+     * nothing has been received, and the caller should fall back to
+     * epoll.
+     */
+    bool serve_uring(Worker& w, const int cfd,
+		     const std::vector<Worker>& workers,
+		     const Options& opt,
+		     const Limit* limit)
+    {
+	enum { RECV = 1, SEND, CONTROL };
+	auto data = [] (uint64_t kind, uint64_t ep, uint64_t bid) {
+	    return kind << 56 | bid << 32 | ep;
+	};
+
+	Uring ring(256);
+	if(ring.err || !ring.probe(IORING_OP_RECVMSG)) return false;
+
+	/* what recvmsg wants to see; only the lengths matter */
+	msghdr tmpl = {};
+	tmpl.msg_namelen = sizeof(sockaddr_storage);
+	tmpl.msg_controllen = sizeof Msg::ctl;
+
+	const size_t headroom = sizeof(io_uring_recvmsg_out)
+			      + tmpl.msg_namelen
+			      + tmpl.msg_controllen;
+	BufRing br(ring, 0, 256,
+		   headroom + (opt.gro ? maxgro : opt.maxsize));
+	if(br.err) return false;
+
+	/* the sendmsg state for each buffer */
+	struct Send {
+	    msghdr h;
+	    iovec iov;
+	    unsigned count;
+	};
+	std::vector<Send> send(br.count);
+
+	auto sqe = [&ring] () {
+	    io_uring_sqe* e = ring.sqe();
+	    while(!e) {
+		ring.submit(0);
+		e = ring.sqe();
+	    }
+	    return e;
+	};
+
+	auto arm = [&] (unsigned index) {
+	    io_uring_sqe* e = sqe();
+	    e->opcode = IORING_OP_RECVMSG;
+	    e->fd = w.ep[index].fd;
+	    e->addr = reinterpret_cast<unsigned long>(&tmpl);
+	    e->ioprio = IORING_RECV_MULTISHOT;
+	    e->flags = IOSQE_BUFFER_SELECT;
+	    e->buf_group = br.bgid;
+	    e->user_data = data(RECV, index, 0);
+	};
+
+	auto arm_control = [&] () {
+	    io_uring_sqe* e = sqe();
+	    e->opcode = IORING_OP_POLL_ADD;
+	    e->fd = cfd;
+	    e->len = IORING_POLL_ADD_MULTI;
+	    e->poll32_events = POLLIN;
+	    e->user_data = data(CONTROL, 0, 0);
+	};
+
+	for(unsigned i=0; i<w.ep.size(); i++) arm(i);
+	if(cfd!=-1) arm_control();
+
+	bool started = false;
+	bool supported = true;
+	bool control = false;
+	bool die = false;
+	std::vector<unsigned> rearm;
+
+	auto complete = [&] (const io_uring_cqe& cqe) {
+	    const unsigned kind = cqe.user_data >> 56;
+	    const unsigned index = cqe.user_data & 0xffffffff;
+	    const bool more = cqe.flags & IORING_CQE_F_MORE;
+
+	    if(kind==CONTROL) {
+		/* later, when we don't hold the lock */
+		control = true;
+		if(!more) arm_control();
+		return;
+	    }
+
+	    Endpoint& ep = w.ep[index];
+
+	    if(kind==SEND) {
+		const unsigned bid = cqe.user_data >> 32 & 0xffff;
+		if(cqe.res < 0) ep.err += send[bid].count;
+		else ep.tx += send[bid].count;
+		br.recycle(bid);
+		return;
+	    }
+
+	    if(!more) rearm.push_back(index);
+	    if(cqe.res < 0) {
+		if(cqe.res==-EINVAL && !started) supported = false;
+		else if(cqe.res!=-ENOBUFS) ++ep.err;
+		return;
+	    }
+	    started = true;
+
+	    const unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+	    char* const buf = br.buf(bid);
+	    io_uring_recvmsg_out out;
+	    std::memcpy(&out, buf, sizeof out);
+	    char* const name = buf + sizeof out;
+	    char* const control = name + tmpl.msg_namelen;
+	    char* const payload = control + tmpl.msg_controllen;
+
+	    Send& s = send[bid];
+	    s.iov.iov_base = payload;
+	    s.iov.iov_len = out.payloadlen;
+	    s.h = {};
+	    s.h.msg_name = name;
+	    s.h.msg_namelen = out.namelen;
+	    s.h.msg_iov = &s.iov;
+	    s.h.msg_iovlen = 1;
+	    s.h.msg_control = control;
+	    s.h.msg_controllen = out.controllen;
+	    s.h.msg_flags = out.flags;
+
+	    s.count = received(w, limit, ep, s.h, out.payloadlen);
+	    if(!s.count) {
+		br.recycle(bid);
+		return;
+	    }
+	    if(ep.stamp >= 0) stamp::tx(ep, s.h, stamp::now());
+
+	    io_uring_sqe* e = sqe();
+	    e->opcode = IORING_OP_SENDMSG;
+	    e->fd = ep.fd;
+	    e->addr = reinterpret_cast<unsigned long>(&s.h);
+	    e->msg_flags = MSG_DONTWAIT;
+	    e->user_data = data(SEND, index, bid);
+	};
+
+	while(!die) {
+	    if(ring.submit(1)==-1 && errno!=EINTR) {
+		break;
+	    }
+	    {
+		std::lock_guard<std::mutex> guard(*w.lock);
+		w.now = coarse();
+		ring.reap(complete);
+	    }
+	    if(!supported) return false;
+	    br.publish();
+	    for(unsigned index : rearm) arm(index);
+	    rearm.clear();
+
+	    if(control) {
+		control = false;
+		die = !controlmsg(cfd, workers);
+	    }
+	}
+
+	return true;
     }
+
+
+    /**
+     * The event loop for a worker, which is also the event loop for
+     * the control socket 'cfd' unless that one is -1.
+     * Returns when asked to quit, or on error.
+     */
+    void serve(Worker& w, const int cfd, const std::vector<Worker>& workers,
+	       const Options& opt)
+    {
+	pin_thread(w.cpu);
+
+	std::unique_ptr<Limit> limit;
+	if(opt.limit) limit.reset(new Limit(opt.limit, opt.burst, opt.tick));
+
+	if(opt.uring) {
+	    if(serve_uring(w, cfd, workers, opt, limit.get())) return;
+	    std::cerr << "warning: no io_uring support; using epoll\n";
+	}
+
+	Batch b(opt.batch, opt.gro ? maxgro : opt.maxsize);
+#ifdef HAS_MMSG
+	const int per_call = b.size;
+#else
+	const int per_call = 1;
 #endif
 
+	/* The endpoints are edge-triggered, so once an endpoint is
+	 * reported readable it stays on the 'ready' list until it has
+	 * been drained.  Each turn, an endpoint gets at most
+	 * opt.drain batches times its weight, so that a busy one
+	 * cannot starve the others.  'since' is when it last went on
+	 * the list, or was put back there at the end of a turn.
+	 */
+	std::vector<epoll_event> ev(opt.events);
+	std::vector<unsigned> ready;
+	std::vector<unsigned> again;
+	std::vector<bool> queued(w.ep.size());
+	std::vector<uint64_t> since(w.ep.size());
+
+	/* One epoll_wait(2), and then one turn over whatever is ready,
+	 * except that the control socket is served first.  Returns
+	 * false when it's time to exit.
+	 */
+	auto wait = [&] () {
+	    const int n = epoll_wait(w.efd, ev.data(), ev.size(),
+				     ready.empty() ? -1 : 0);
+
+	    if(n==-1 && errno==EINTR) {
+		return true;
+	    }
+	    if(n<0 || (n==0 && ready.empty())) {
+		return false;
+	    }
+
+	    const uint64_t t0 = fine();
+	    for(int i=0; i<n; i++) {
+		const unsigned index = ev[i].data.u32;
+		if(index==~0u) {
+		    if(!controlmsg(cfd, workers)) return false;
+		    continue;
+		}
+		if(!queued[index]) {
+		    queued[index] = true;
+		    since[index] = t0;
+		    ready.push_back(index);
+		}
+	    }
+
+	    again.clear();
+	    for(unsigned index : ready) {
+		Endpoint& e = w.ep[index];
+		++e.waits;
+		e.waited += fine() - since[index];
+
+		bool drained = false;
+		const unsigned quota = opt.drain * e.weight;
+		for(unsigned k=0; !drained && k<quota; k++) {
+		    drained = reflect(w, limit.get(), e, b,
+				      MSG_DONTWAIT) < per_call;
+		}
+		if(drained) {
+		    queued[index] = false;
+		}
+		else {
+		    again.push_back(index);
+		}
+	    }
+	    if(!again.empty()) {
+		const uint64_t t = fine();
+		for(unsigned index : again) since[index] = t;
+	    }
+	    ready.swap(again);
+	    return true;
+	};
+
+	if(!opt.busy) {
+	    while(wait()) {
+		;
+	    }
+	    return;
+	}
+
+	/* Busy polling: non-blocking reads from all endpoints in
+	 * turn, with the (then non-blocking) control socket polled
+	 * now and then.  With a budget, that many idle rounds in a row
+	 * sends us to sleep in epoll_wait(2) until something happens.
+	 */
+	unsigned empty = 0;
+	for(unsigned round = 0; ; round++) {
+	    bool any = false;
+	    for(Endpoint& e : w.ep) {
+		if(reflect(w, limit.get(), e, b, MSG_DONTWAIT)) any = true;
+	    }
+	    ++w.rounds;
+
+	    if(cfd!=-1 && round % 256 == 0 && !controlmsg(cfd, workers)) {
+		return;
+	    }
+
+	    if(any) {
+		empty = 0;
+		continue;
+	    }
+	    ++w.idle;
+
+	    if(opt.budget && ++empty >= opt.budget) {
+		empty = 0;
+		++w.sleeps;
+		if(!wait()) return;
+	    }
+	}
+    }
+
 
-    int udpserver(const std::string& control,
-		  const std::vector<std::string>& sockets,
-		  const bool verbose)
+    /**
+     * Ask the kernel to busy-poll the device queue for up to 50 us
+     * when we read from an empty socket, and to prefer that over
+     * interrupts.  The first needs CAP_NET_ADMIN if it's more than
+     * net.core.busy_read; the second is Linux 5.11.
+     */
+    bool busy_poll(const int fd)
+    {
+	const int usec = 50;
+	const int one = 1;
+	return !setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec)
+	    && !setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+			   &one, sizeof one);
+    }
+
+
+    /**
+     * Make sure we may have 'n' file descriptors open, or as close to
+     * it as the hard limit allows.
+     */
+    void nofile(const rlim_t n)
     {
-	const int efd = epoll_create(1);
-	assert(efd > 0);
+	rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur >= n) return;
+
+	rl.rlim_cur = std::min(n, rl.rlim_max);
+	if(setrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur < n) {
+	    std::cerr << "warning: may only open " << rl.rlim_cur
+		      << " files; need " << n << '\n';
+	}
+    }
+
+
+    int udpserver(const Options& opt,
+		  const std::vector<std::string>& sockets)
+    {
+	const bool threaded = opt.threads > 0;
+	const unsigned nworkers = std::max(opt.threads, 1u);
+	std::vector<int> cpu;
+	if(!placement(cpu, nworkers, opt.cpu, threaded)) {
+	    std::cerr << "error: cpu " << opt.cpu << " is not available\n";
+	    return 1;
+	}
+
+	std::vector<Worker> workers;
+	for(unsigned i=0; i<nworkers; i++) {
+	    const int efd = epoll_create(1);
+	    assert(efd > 0);
+	    workers.push_back(Worker(efd, cpu[i], opt.peers, opt.limit > 0));
+	}
+
+	rlim_t nfd = 16;
+	for(std::string s : sockets) {
+	    std::string host;
+	    std::string port;
+	    unsigned first;
+	    unsigned last;
+	    const unsigned weight = weight_of(s);
+	    if(!weight) {
+		std::cerr << s << ": error: bad weight\n";
+		return 1;
+	    }
+	    if(weight > 1 && (opt.uring || opt.busy)) {
+		std::cerr << s << ": error: weights need the epoll engine,"
+			  << " without --busy-poll\n";
+		return 1;
+	    }
+	    host_and_port(s.c_str(), host, port);
+	    const unsigned n = port_range(port, first, last)
+			     ? last - first + 1 : 1;
+	    nfd += n * workers.size();
+	}
+	nofile(nfd);
 
 	int cfd = -1;
-	if(!control.empty()) {
+	if(!opt.control.empty()) {
 
-	    const Addrinfo cai(control);
+	    const Addrinfo cai(opt.control);
 	    if(cai.err) {
 		std::cerr << "error: cannot open control socket: "
 			  << cai.strerror() << '\n';
@@ -380,67 +1716,122 @@ namespace {
 		return 1;
 	    }
 
-	    epoll_add(efd, cfd, ~0u);
+	    if(!threaded) {
+		epoll_add(workers.front().efd, cfd, ~0u);
+		if(opt.busy) {
+		    const int flags = fcntl(cfd, F_GETFL, 0);
+		    fcntl(cfd, F_SETFL, flags | O_NONBLOCK);
+		}
+	    }
 	}
 
-	std::vector<Endpoint> ep;
-
 	for(std::vector<std::string>::const_iterator i = sockets.begin();
 	    i!= sockets.end(); i++) {
-	    const Addrinfo ai(*i);
+	    std::string spec = *i;
+	    const unsigned weight = weight_of(spec);
+	    const Addrinfo ai(spec);
 	    if(ai.err) {
 		std::cerr << *i << ": error: cannot open socket: "
 			  << ai.strerror() << '\n';
 		return 1;
 	    }
 
-	    int fd = ai.socket();
-	    if(fd==-1) {
-		std::cerr << *i << ": error: cannot open socket: "
-			  << strerror(errno) << '\n';
-		return 1;
-	    }
+	    for(unsigned port = ai.first; port <= ai.last; port++) {
+		std::string name = spec;
+		if(port) {
+		    name = std::to_string(port);
+		    if(!ai.host.empty()) name = ai.host + ':' + name;
+		}
+		/* warnings are for the first socket of a range */
+		const bool first = port==ai.first;
 
-	    ep.push_back(Endpoint(*i, fd));
-	    epoll_add(efd, fd, ep.size()-1);
+		for(Worker& w : workers) {
+		    const bool once = first && &w==&workers.front();
 
-	    if(verbose) {
-		std::cout << *i << " on fd " << fd << '\n';
-	    }
-	}
+		    int fd = ai.socket(threaded, port);
+		    if(fd==-1) {
+			std::cerr << name << ": error: cannot open socket: "
+				  << strerror(errno) << '\n';
+			return 1;
+		    }
 
-	bool die = false;
-	while(!die) {
-	    struct epoll_event ev[10];
-	    const int n = epoll_wait(efd, ev, 10, -1);
+		    const int one = 1;
+		    if(opt.gro && setsockopt(fd, IPPROTO_UDP, UDP_GRO,
+					     &one, sizeof one)) {
+			std::cerr << name << ": error: cannot enable UDP_GRO: "
+				  << strerror(errno) << '\n';
+			return 1;
+		    }
+		    if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL,
+				  &one, sizeof one) && once) {
+			std::cerr << name
+				  << ": warning: cannot enable SO_RXQ_OVFL: "
+				  << strerror(errno) << '\n';
+		    }
+		    if(opt.stamp >= 0 && setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS,
+						    &one, sizeof one)) {
+			std::cerr << name
+				  << ": error: cannot enable SO_TIMESTAMPNS: "
+				  << strerror(errno) << '\n';
+			return 1;
+		    }
+		    if(opt.busy && !busy_poll(fd) && once) {
+			std::cerr << name
+				  << ": warning: cannot enable busy polling: "
+				  << strerror(errno) << '\n';
+		    }
+		    if(opt.rcvbuf) {
+			const int granted = rcvbuf(fd, opt.rcvbuf);
+			if(once) {
+			    std::cout << spec << ": receive buffer " << granted
+				      << " octets (asked for " << opt.rcvbuf
+				      << ")\n";
+			}
+		    }
 
-	    if(n==-1 && errno==EINTR) {
-		continue;
-	    }
-	    if(n<1) {
-		die = true;
-		continue;
-	    }
+		    w.ep.push_back(Endpoint(name, fd, weight));
+		    w.ep.back().stamp = opt.stamp;
+		    epoll_add(w.efd, fd, w.ep.size()-1, EPOLLIN | EPOLLET);
 
-	    for(int i=0; i<n; i++) {
-		const unsigned index = ev[i].data.u32;
-		if(index==~0u) {
-		    die = !controlmsg(cfd, ep);
-		    if(die) {
-			break;
-		    }
-		    else {
-			continue;
+		    if(opt.verbose) {
+			std::cout << name << " on fd " << fd;
+			if(weight > 1) std::cout << ", weight " << weight;
+			if(threaded) std::cout << ", cpu " << w.cpu;
+			std::cout << '\n';
 		    }
 		}
-		Endpoint& e = ep[index];
-		reflect(e);
 	    }
 	}
 
-	/* should clean up, I suppose ... */
+	baseline = Snapshot(workers);
+
+	if(!threaded) {
+	    serve(workers.front(), cfd, workers, opt);
+	    /* should clean up, I suppose ... */
+	    return 0;
+	}
+
+	std::vector<std::thread> threads;
+	for(Worker& w : workers) {
+	    threads.push_back(std::thread(serve, std::ref(w), -1,
+					  std::cref(workers), std::cref(opt)));
+	}
+
+	if(cfd==-1) {
+	    for(std::thread& t : threads) t.join();
+	    return 0;
+	}
 
-	return 0;
+	while(controlmsg(cfd, workers)) {
+	    ;
+	}
+
+	/* The workers may be anywhere, using 'workers' and holding
+	 * their locks, so we cannot return and destroy it under them.
+	 * Exit right here instead; that takes care of them.
+	 */
+	std::cout.flush();
+	_exit(0);
     }
 }
 
@@ -452,31 +1843,140 @@ int main(int argc, char ** argv)
     const string prog = argv[0];
     const string usage = string("usage: ")
 	+ prog
-	+ " [-v] [--control port] [host:]port ...";
+	+ " [-v] [--control port] [--threads N] [--batch N]"
+	+ " [--max-size octets] [--events N] [--drain N]"
+	+ " [--timestamp offset]"
+	+ " [--engine=epoll|uring] [--gro] [--rcvbuf octets]"
+	+ " [--peers N] [--limit pps[,burst]]"
+	+ " [--busy-poll[=N]] [--cpu N] [host:]port[/weight] ...";
     const char optstring[] = "vhc:";
     struct option long_options[] = {
 	{"version", 0, 0, 'V'},
 	{"help", 0, 0, 'h'},
 	{"control", 1, 0, 'c'},
+	{"threads", 1, 0, 'T'},
+	{"batch", 1, 0, 'B'},
+	{"engine", 1, 0, 'E'},
+	{"gro", 0, 0, 'G'},
+	{"rcvbuf", 1, 0, 'R'},
+	{"peers", 1, 0, 'P'},
+	{"limit", 1, 0, 'L'},
+	{"max-size", 1, 0, 'M'},
+	{"events", 1, 0, 'e'},
+	{"drain", 1, 0, 'D'},
+	{"timestamp", 1, 0, 'S'},
+	{"busy-poll", 2, 0, 'Y'},
+	{"cpu", 1, 0, 'U'},
 	{0, 0, 0, 0}
     };
 
-    bool verbose = false;
-    string control;
+    Options opt;
 
     int ch;
     while((ch = getopt_long(argc, argv,
 			    optstring, &long_options[0], 0)) != -1) {
 	switch(ch) {
 	case 'v':
-	    verbose = true;
+	    opt.verbose = true;
 	    break;
 	case 'h':
 	    std::cout << usage << '\n';
 	    return 0;
 	    break;
 	case 'c':
-	    control = optarg;
+	    opt.control = optarg;
+	    break;
+	case 'T':
+	    {
+		char* end;
+		const unsigned long n = std::strtoul(optarg, &end, 10);
+		if(end==optarg || *end || optarg[0]=='-' || n > 1024) {
+		    std::cerr << "error: the number of threads must be 0--1024\n";
+		    return 1;
+		}
+		opt.threads = n;
+	    }
+	    break;
+	case 'B':
+	    opt.batch = std::strtoul(optarg, 0, 10);
+	    if(opt.batch < 1 || opt.batch > 256) {
+		std::cerr << "error: the batch size must be 1--256\n";
+		return 1;
+	    }
+	    break;
+	case 'e':
+	    opt.events = std::strtoul(optarg, 0, 10);
+	    if(opt.events < 1 || opt.events > 65536) {
+		std::cerr << "error: the number of events must be 1--65536\n";
+		return 1;
+	    }
+	    break;
+	case 'D':
+	    opt.drain = std::strtoul(optarg, 0, 10);
+	    if(opt.drain < 1) {
+		std::cerr << "error: the drain budget must be at least 1\n";
+		return 1;
+	    }
+	    break;
+	case 'S':
+	    opt.stamp = std::strtol(optarg, 0, 10);
+	    if(opt.stamp < 0 || opt.stamp > 65535) {
+		std::cerr << "error: bad timestamp offset " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'M':
+	    opt.maxsize = std::strtoul(optarg, 0, 10);
+	    if(opt.maxsize < 1 || opt.maxsize > 65535) {
+		std::cerr << "error: the max size must be 1--65535\n";
+		return 1;
+	    }
+	    break;
+	case 'E':
+	    if(string(optarg)=="uring") {
+		opt.uring = true;
+	    }
+	    else if(string(optarg)!="epoll") {
+		std::cerr << "error: no such engine: " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'G':
+	    opt.gro = true;
+	    break;
+	case 'R':
+	    opt.rcvbuf = std::strtol(optarg, 0, 10);
+	    break;
+	case 'P':
+	    opt.peers = std::strtoul(optarg, 0, 10);
+	    break;
+	case 'L':
+	    {
+		char* end;
+		opt.limit = std::strtod(optarg, &end);
+		bool bad = end==optarg || !(opt.limit >= 1 && opt.limit <= 1e9);
+		if(*end==',') {
+		    const char* s = end + 1;
+		    const unsigned long n = std::strtoul(s, &end, 10);
+		    bad = bad || end==s || *s=='-' || n > 1000000000;
+		    opt.burst = n;
+		}
+		else {
+		    opt.burst = std::max(opt.limit/10, 1.0);
+		}
+		if(bad || *end) {
+		    std::cerr << "error: bad rate limit " << optarg
+			      << " (1--1e9 pps, and a burst of at most 1e9)\n";
+		    return 1;
+		}
+	    }
+	    break;
+	case 'Y':
+	    opt.busy = true;
+	    if(optarg) opt.budget = std::strtoul(optarg, 0, 10);
+	    break;
+	case 'U':
+	    opt.cpu = std::strtol(optarg, 0, 10);
 	    break;
 	case 'V':
 	    std::cout << prog << ", the only version\n";
@@ -492,7 +1992,27 @@ int main(int argc, char ** argv)
 	}
     }
 
-    if(control.empty() && argc - optind == 0) {
+    if(opt.busy && opt.uring) {
+	std::cerr << "error: --busy-poll needs the epoll engine\n";
+	return 1;
+    }
+
+    if(opt.limit && !opt.peers) {
+	std::cerr << "error: --limit needs the peer table\n";
+	return 1;
+    }
+
+    if(opt.limit) {
+	opt.tick = coarse_tick();
+	const unsigned burst = Limit(opt.limit, opt.burst, opt.tick).burst();
+	if(burst > opt.burst) {
+	    std::cout << "rate limit: burst raised to " << burst
+		      << ", what arrives in one " << opt.tick / 1000
+		      << " us clock tick\n";
+	}
+    }
+
+    if(opt.control.empty() && argc - optind == 0) {
 	/* neither control port nor any traffic ports */
 	std::cerr << usage << '\n';
 	return 1;
@@ -501,5 +2021,5 @@ int main(int argc, char ** argv)
     const std::vector<string> sockets(argv + optind,
 				      argv + argc);
 
-    return udpserver(control, sockets, verbose);
+    return udpserver(opt, sockets);
 }
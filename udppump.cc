@@ -7,25 +7,224 @@
  *
  */
 #include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <ostream>
 #include <cassert>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <ctime>
 
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "hexread.h"
+#include "seqhdr.h"
+#include "profile.h"
+#include "histogram.h"
+#include "portrange.h"
+
+#ifndef SO_TXTIME
+/* Linux 4.19, but not yet in all libc headers */
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#ifndef SO_ZEROCOPY
+/* Linux 4.14 */
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 
 namespace {
 
-    int udpclient(const std::string& host,
-		  const std::string& port)
+    /**
+     * How to keep to --rate: by sleeping until each datagram is due,
+     * by having the fq qdisc do it (SO_MAX_PACING_RATE), or by
+     * telling the qdisc when each one is due (SO_TXTIME).  The last
+     * two need fq (or etf) on the outgoing interface.
+     */
+    enum class Pacing { USER, FQ, TXTIME };
+
+    /**
+     * The command-line options, except host and port.
+     */
+    struct Options {
+	uint64_t npackets = 1000000;
+	double rate = 0;
+	double bitrate = 0;
+	Pacing pacing = Pacing::USER;
+	unsigned batch = 1;
+	std::vector<uint8_t> payload;
+	unsigned size = 0;
+	unsigned threads = 1;
+	unsigned flows = 0;
+	bool stamp = false;
+	SeqHdr::Clock clock = SeqHdr::REALTIME;
+	double interval = 0;
+	unsigned backoff = 0;
+	Profile profile;
+	unsigned zerocopy = 0;
+	bool rtt = false;
+	unsigned window = 0;
+	std::string search;
+	double loss = 0;
+	double trial = 2;
+	std::vector<unsigned> sizes;
+	bool sweep = false;
+    };
+
+    uint64_t now()
     {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    /**
+     * Wait until 'early' ns before 'deadline'.  Deadlines come from
+     * the Schedule, relative to when sending started, so a late
+     * datagram doesn't push back the ones after it; the schedule
+     * corrects itself.
+     *
+     * Sleeps with clock_nanosleep(2) until shortly before the
+     * deadline, and spins on the (vDSO, TSC-based) clock for the rest
+     * of the way, since a sleep tends to oversleep by tens of
+     * microseconds.
+     */
+    void wait(uint64_t deadline, uint64_t early)
+    {
+	const uint64_t slack = 60000;
+	deadline -= std::min(deadline, early);
+	if(deadline > now() + slack) {
+	    const uint64_t t = deadline - slack;
+	    timespec ts;
+	    ts.tv_sec = t / 1000000000;
+	    ts.tv_nsec = t % 1000000000;
+	    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0)==EINTR) {
+		;
+	    }
+	}
+	while(now() < deadline) {
+	    ;
+	}
+    }
+
+    /**
+     * The gaps between datagrams actually sent, and how late they
+     * were compared to the schedule, for the final report.
+     * Running mean and variance, Welford-style, so nothing is
+     * stored per datagram.
+     */
+    struct Gaps {
+	void add(uint64_t t, uint64_t due);
+
+	uint64_t n = 0;
+	uint64_t first = 0;
+	uint64_t prev = 0;
+	double mean = 0;
+	double m2 = 0;
+	uint64_t late = 0;
+
+	double elapsed() const { return (prev - first) * 1e-9; }
+	double jitter() const { return n > 2 ? std::sqrt(m2 / (n - 2)) : 0; }
+    };
+
+    void Gaps::add(uint64_t t, uint64_t due)
+    {
+	if(n++) {
+	    const double gap = t - prev;
+	    const double d = gap - mean;
+	    mean += d / (n - 1);
+	    m2 += d * (gap - mean);
+	}
+	else {
+	    first = t;
+	}
+	prev = t;
+	if(due && t > due) late = std::max(late, t - due);
+    }
+
+    /**
+     * Parse a list of sizes like "64,128,512", or "64,128,...,65507"
+     * where "..." continues the progression before it, doubling or
+     * adding, until the size after it.
+     */
+    bool sizes(const char* p, std::vector<unsigned>& v)
+    {
+	v.clear();
+	bool more = false;
+	for(;;) {
+	    if(std::strncmp(p, "...,", 4)==0 && v.size() >= 2 && !more) {
+		more = true;
+		p += 4;
+		continue;
+	    }
+	    char* end;
+	    const unsigned long n = std::strtoul(p, &end, 10);
+	    if(end==p || n < 1 || n > 65507) return false;
+
+	    if(more) {
+		const unsigned a = v[v.size() - 2];
+		const unsigned b = v.back();
+		if(b <= a || n <= b) return false;
+		for(;;) {
+		    const unsigned c = b==2*a ? 2*v.back() : v.back() + b - a;
+		    if(c >= n) break;
+		    v.push_back(c);
+		}
+		more = false;
+	    }
+	    v.push_back(n);
+
+	    if(!*end) return true;
+	    if(*end!=',') return false;
+	    p = end + 1;
+	}
+    }
+
+    /**
+     * Connect 'nflows' sockets to host:port.  Each gets its own
+     * ephemeral source port, and if 'port' is a range, the flows
+     * take turns over the destination ports in it.  Returns nothing
+     * on failure.
+     */
+    std::vector<int> udpclient(const std::string& host,
+			       std::string port,
+			       const unsigned nflows,
+			       std::ostream& os = std::cout)
+    {
+	unsigned first = 0;
+	unsigned last = 0;
+	if(port_range(port, first, last)) {
+	    port = std::to_string(first);
+	}
+
 	static const struct addrinfo hints = { AI_ADDRCONFIG | AI_CANONNAME,
 					       AF_UNSPEC,
 					       SOCK_DGRAM,
@@ -38,59 +237,1277 @@ namespace {
 			     &suggestions);
 	if(rc) {
 	    std::cerr << "error: " << gai_strerror(rc) << '\n';
-	    return -1;
+	    return {};
 	}
 
-	const struct addrinfo& first = *suggestions;
+	const struct addrinfo& ai = *suggestions;
 
-	std::cout << "connecting to: " << first.ai_canonname << '\n';
+	os << "connecting to: " << ai.ai_canonname << '\n';
 
-	int fd = socket(first.ai_family,
-			first.ai_socktype,
-			first.ai_protocol);
-	if(fd==-1) {
-	    std::cerr << "error: " << strerror(errno) << '\n';
-	    return -1;	    
-	}
+	std::vector<int> fds;
+	for(unsigned i=0; i<nflows; i++) {
+	    int fd = socket(ai.ai_family,
+			    ai.ai_socktype,
+			    ai.ai_protocol);
+	    if(fd==-1) {
+		std::cerr << "error: " << strerror(errno) << '\n';
+		break;
+	    }
 
-	rc = connect(fd, first.ai_addr, first.ai_addrlen);
-	if(rc) {
-	    std::cerr << "error: " << strerror(errno) << '\n';
-	    return -1;	    
+	    sockaddr_storage sa;
+	    std::memcpy(&sa, ai.ai_addr, ai.ai_addrlen);
+	    if(first) {
+		const uint16_t p = htons(first + i % (last - first + 1));
+		if(sa.ss_family==AF_INET) {
+		    reinterpret_cast<sockaddr_in&>(sa).sin_port = p;
+		}
+		else if(sa.ss_family==AF_INET6) {
+		    reinterpret_cast<sockaddr_in6&>(sa).sin6_port = p;
+		}
+	    }
+
+	    rc = connect(fd, reinterpret_cast<sockaddr*>(&sa), ai.ai_addrlen);
+	    if(rc) {
+		std::cerr << "error: " << strerror(errno) << '\n';
+		close(fd);
+		break;
+	    }
+	    fds.push_back(fd);
 	}
 
 	freeaddrinfo(suggestions);
 
-	return fd;
+	if(fds.size() < nflows) {
+	    for(int fd : fds) close(fd);
+	    fds.clear();
+	}
+	return fds;
+    }
+
+    /**
+     * Set up kernel pacing for --pacing=fq or txtime; false on
+     * failure.  The fq rate is in octets per second, and counts IP
+     * and UDP headers, so 'size' is what goes on the wire.
+     */
+    bool pacing(int fd, const Options& opt, double rate, size_t size)
+    {
+	if(opt.pacing==Pacing::FQ) {
+	    const uint64_t octets = rate * size;
+	    return !setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+			       &octets, sizeof octets);
+	}
+	if(opt.pacing==Pacing::TXTIME) {
+	    sock_txtime txt = {};
+	    txt.clockid = CLOCK_MONOTONIC;
+	    return !setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txt, sizeof txt);
+	}
+	return true;
+    }
+
+    /**
+     * The datagrams for one sendmmsg(2), all built up front.  Each
+     * has its own copy of the payload and, with --pacing=txtime, its
+     * own SCM_TXTIME cmsg, so only the transmit times change from one
+     * call to the next.  With --zerocopy, the payloads come from 'zc'
+     * instead, a ring which lasts as long as the batch does.
+     */
+    class Zerocopy;
+
+    struct Batch {
+	Batch(unsigned size, const std::vector<uint8_t>& payload, bool txtime);
+	~Batch();
+
+	const unsigned size;
+	std::vector<uint8_t> mem;
+	std::vector<iovec> iov;
+	std::vector<mmsghdr> msg;
+	std::unique_ptr<Zerocopy> zc;
+
+	struct Txtime {
+	    alignas(cmsghdr) char buf[CMSG_SPACE(sizeof(uint64_t))];
+	};
+	std::vector<Txtime> ctl;
+
+	void due(unsigned i, uint64_t t);
+    };
+
+    Batch::Batch(unsigned size, const std::vector<uint8_t>& payload,
+		 bool txtime)
+	: size(size),
+	  mem(size * payload.size()),
+	  iov(size),
+	  msg(size),
+	  ctl(txtime ? size : 0)
+    {
+	const size_t len = payload.size();
+	for(unsigned i=0; i<size; i++) {
+	    uint8_t* p = &mem[i * len];
+	    std::copy(payload.begin(), payload.end(), p);
+	    iov[i].iov_base = p;
+	    iov[i].iov_len = len;
+
+	    msghdr& h = msg[i].msg_hdr;
+	    h = {};
+	    h.msg_iov = &iov[i];
+	    h.msg_iovlen = 1;
+	    if(!txtime) continue;
+
+	    h.msg_control = ctl[i].buf;
+	    h.msg_controllen = sizeof ctl[i].buf;
+	    cmsghdr* c = CMSG_FIRSTHDR(&h);
+	    c->cmsg_level = SOL_SOCKET;
+	    c->cmsg_type = SCM_TXTIME;
+	    c->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	}
+    }
+
+    /**
+     * Set the SCM_TXTIME of datagram 'i'.
+     */
+    void Batch::due(unsigned i, uint64_t t)
+    {
+	cmsghdr* c = CMSG_FIRSTHDR(&msg[i].msg_hdr);
+	std::memcpy(CMSG_DATA(c), &t, sizeof t);
+    }
+
+    /**
+     * Report 'n' datagrams, 'octets' octets of payload in all, over
+     * 't' seconds.  With varying sizes, the size is the mean.
+     */
+    void report(uint64_t n, uint64_t octets, double t, const Gaps& gaps,
+		double rate, unsigned batch)
+    {
+	const double pps = t > 0 ? n / t : 0;
+	char buf[200];
+	std::snprintf(buf, sizeof buf,
+		      "%.0f octets: %.0f pps, %.0f bit/s over %.3f s\n",
+		      n ? double(octets) / n : 0, pps,
+		      t > 0 ? octets * 8 / t : 0, t);
+	std::cout << buf;
+	if(!rate) return;
+
+	const char* what = batch > 1 ? "batch gap" : "gap";
+	std::snprintf(buf, sizeof buf,
+		      "%s %.2f us (target %.2f us), jitter %.2f us, "
+		      "at most %.1f us late\n",
+		      what, gaps.mean / 1e3, 1e6 * batch / rate,
+		      gaps.jitter() / 1e3, gaps.late / 1e3);
+	std::cout << buf;
+    }
+
+    /* errno values below maxerrno are counted separately, and the
+     * rest together, as "other"
+     */
+    const int maxerrno = 256;
+    const int othererr = maxerrno;
+    const int nerrors = maxerrno + 1;
+
+    int bucket(const int err)
+    {
+	return err > 0 && err < maxerrno ? err : othererr;
+    }
+
+    /**
+     * What one thread did.  Each thread has its own, on its own
+     * cache lines.  The counters are updated by that thread only, with
+     * a relaxed load and store rather than a read-modify-write, and
+     * may be read by the --interval reporter at any time.  The rest
+     * is only read once the thread is done.
+     */
+    struct alignas(64) Result {
+	std::atomic<uint64_t> sent {0};
+	std::atomic<uint64_t> octets {0};
+	std::atomic<uint64_t> errors[nerrors] {};
+	std::atomic<bool> done {false};
+	bool failed = false;
+	double t = 0;
+	Gaps gaps;
+	uint64_t copied = 0;
+	uint64_t zerocopied = 0;
+	double cpu = 0;
+	double utime = 0;
+	double stime = 0;
+
+	void count(std::atomic<uint64_t>& c, uint64_t n) {
+	    c.store(c.load(std::memory_order_relaxed) + n,
+		    std::memory_order_relaxed);
+	}
+	uint64_t get(const std::atomic<uint64_t>& c) const {
+	    return c.load(std::memory_order_relaxed);
+	}
+    };
+
+    /**
+     * The errors we expect to go away by themselves: a full qdisc or
+     * socket buffer, and an ICMP error from some earlier datagram.
+     * The datagram is lost, but there's no reason to stop.
+     */
+    bool transient(const int err)
+    {
+	switch(err) {
+	case ENOBUFS:
+	case EAGAIN:
+	case ENOMEM:
+	case EINTR:
+	case ECONNREFUSED:
+	case EHOSTUNREACH:
+	case ENETUNREACH:
+	    return true;
+	default:
+	    return false;
+	}
+    }
+
+    std::string errname(const int err)
+    {
+	if(err==othererr) return "other";
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 32)
+	const char* s = err ? strerrorname_np(err) : 0;
+	if(s) return s;
+#endif
+	return "errno " + std::to_string(err);
+    }
+
+    /**
+     * The error counts in 'errors' which aren't zero, as in
+     * ", ENOBUFS 12, ECONNREFUSED 1".
+     */
+    std::string errors(const std::vector<uint64_t>& errors)
+    {
+	std::string acc;
+	for(int i=0; i<nerrors; i++) {
+	    if(!errors[i]) continue;
+	    acc += ", " + errname(i) + ' ' + std::to_string(errors[i]);
+	}
+	return acc;
+    }
+
+    /**
+     * Every 'interval' seconds, print the rates and errors since last
+     * time, until all threads are done.
+     */
+    void reporter(const std::vector<Result>& res, const double interval)
+    {
+	const uint64_t t0 = now();
+	uint64_t t = t0;
+	const uint64_t step = interval * 1e9;
+	uint64_t deadline = t;
+	uint64_t sent = 0;
+	uint64_t octets = 0;
+	std::vector<uint64_t> err(nerrors);
+
+	bool done = false;
+	while(!done) {
+	    deadline += step;
+	    timespec ts;
+	    ts.tv_sec = deadline / 1000000000;
+	    ts.tv_nsec = deadline % 1000000000;
+	    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0)==EINTR) {
+		;
+	    }
+
+	    done = true;
+	    for(const Result& r : res) {
+		done = done && r.done.load(std::memory_order_acquire);
+	    }
+
+	    uint64_t sent2 = 0;
+	    uint64_t octets2 = 0;
+	    std::vector<uint64_t> err2(nerrors);
+	    for(const Result& r : res) {
+		sent2 += r.get(r.sent);
+		octets2 += r.get(r.octets);
+		for(int i=0; i<nerrors; i++) err2[i] += r.get(r.errors[i]);
+	    }
+	    std::vector<uint64_t> derr(nerrors);
+	    for(int i=0; i<nerrors; i++) derr[i] = err2[i] - err[i];
+
+	    const uint64_t t2 = now();
+	    const double dt = (t2 - t) * 1e-9;
+	    char buf[100];
+	    std::snprintf(buf, sizeof buf, "%8.3f s: %.0f pps, %.0f bit/s",
+			  (t2 - t0) * 1e-9, (sent2 - sent) / dt,
+			  (octets2 - octets) * 8 / dt);
+	    std::cout << buf << errors(derr) << std::endl;
+
+	    t = t2;
+	    sent = sent2;
+	    octets = octets2;
+	    err.swap(err2);
+	}
+    }
+
+    /**
+     * A connected socket, the sequence number of the next datagram
+     * sent on it with --stamp, and the MSG_ZEROCOPY id of the next
+     * one sent with --zerocopy.  The flows are made by the main
+     * thread, but each is written by its sender on every send, so
+     * it gets a cache line of its own.
+     */
+    struct alignas(64) Flow {
+	int fd;
+	uint32_t id;
+	uint64_t seq;
+	uint32_t zcid = 0;
+    };
+
+    /**
+     * For --zerocopy, a ring of 'count' payload buffers, page-aligned
+     * and each a copy of the payload.  After a MSG_ZEROCOPY send, a
+     * buffer belongs to the kernel until the completion for it shows
+     * up on the socket's error queue, and until then it must not be
+     * rewritten (or, with --stamp, restamped).
+     *
+     * claim(i) is the i:th buffer from the head of the ring, once it's
+     * free; sent(n, f) says the first n claimed went out on flow f,
+     * and moves the head past them.  Completions are only read when
+     * a buffer is needed, and by then the kernel has coalesced them
+     * into ranges of ids.
+     *
+     * If a flow's completions don't show up within a second, the ring
+     * has 'failed': claim() returns null from then on, and the
+     * buffers the kernel never released are never handed out again.
+     */
+    class Zerocopy {
+    public:
+	Zerocopy(unsigned count, const std::vector<uint8_t>& payload);
+	~Zerocopy();
+
+	const unsigned count;
+	uint64_t copied = 0;
+	uint64_t zerocopied = 0;
+	bool failed = false;
+
+	uint8_t* claim(unsigned i);
+	void sent(unsigned n, Flow& f);
+	void finish();
+
+    private:
+	struct Slot {
+	    const Flow* flow;
+	    uint32_t id;
+	};
+
+	size_t stride;
+	size_t len;
+	uint8_t* mem;
+	std::vector<Slot> slots;
+	unsigned head;
+
+	void reap(const Flow& f);
+
+	Zerocopy(const Zerocopy&);
+	Zerocopy& operator= (const Zerocopy&);
+    };
+
+    Zerocopy::Zerocopy(unsigned count, const std::vector<uint8_t>& payload)
+	: count(count),
+	  stride((payload.size() + 4095) & ~size_t(4095)),
+	  len(count * stride),
+	  mem(nullptr),
+	  slots(count, Slot {nullptr, 0}),
+	  head(0)
+    {
+	if(!count) return;
+	void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(p==MAP_FAILED) throw std::bad_alloc();
+	mem = static_cast<uint8_t*>(p);
+	for(unsigned i=0; i<count; i++) {
+	    std::copy(payload.begin(), payload.end(), mem + i*stride);
+	}
+    }
+
+    Zerocopy::~Zerocopy()
+    {
+	if(mem) munmap(mem, len);
+    }
+
+    Batch::~Batch() = default;
+
+    uint8_t* Zerocopy::claim(unsigned i)
+    {
+	const unsigned n = (head + i) % count;
+	while(slots[n].flow && !failed) reap(*slots[n].flow);
+	return failed ? nullptr : mem + n*stride;
+    }
+
+    void Zerocopy::sent(unsigned n, Flow& f)
+    {
+	for(unsigned i=0; i<n; i++) {
+	    slots[head] = Slot {&f, f.zcid++};
+	    head = (head + 1) % count;
+	}
+    }
+
+    /**
+     * Wait for all outstanding completions.
+     */
+    void Zerocopy::finish()
+    {
+	for(const Slot& s : slots) {
+	    while(s.flow && !failed) reap(*s.flow);
+	}
+    }
+
+    /**
+     * Read the completions queued for flow 'f', waiting for at least
+     * one, and free the buffers they're for.
+     */
+    void Zerocopy::reap(const Flow& f)
+    {
+	unsigned n = 0;
+	for(;;) {
+	    alignas(cmsghdr) char ctl[100];
+	    msghdr h = {};
+	    h.msg_control = ctl;
+	    h.msg_controllen = sizeof ctl;
+	    if(recvmsg(f.fd, &h, MSG_ERRQUEUE | MSG_DONTWAIT)==-1) {
+		if(errno==EINTR) continue;
+		if(n) return;
+		pollfd pfd = {f.fd, 0, 0};
+		if(poll(&pfd, 1, 1000)) continue;
+
+		/* Completions should take microseconds.  Without
+		 * them we cannot know when the kernel is done with
+		 * the buffers, so none of them may be rewritten.
+		 */
+		std::cerr << "error: no MSG_ZEROCOPY completions"
+			  << " in a second; giving up\n";
+		failed = true;
+		return;
+	    }
+
+	    for(cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+		const bool recverr = (c->cmsg_level==SOL_IP &&
+				      c->cmsg_type==IP_RECVERR) ||
+				     (c->cmsg_level==SOL_IPV6 &&
+				      c->cmsg_type==IPV6_RECVERR);
+		if(!recverr) continue;
+		sock_extended_err ee;
+		std::memcpy(&ee, CMSG_DATA(c), sizeof ee);
+		if(ee.ee_errno || ee.ee_origin!=SO_EE_ORIGIN_ZEROCOPY) continue;
+
+		const uint32_t lo = ee.ee_info;
+		const uint32_t hi = ee.ee_data;
+		if(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+		    copied += hi - lo + 1;
+		}
+		else {
+		    zerocopied += hi - lo + 1;
+		}
+		for(Slot& s : slots) {
+		    if(s.flow==&f && s.id - lo <= hi - lo) s.flow = nullptr;
+		}
+		n++;
+	    }
+	}
+    }
+
+    /**
+     * With --stamp, put a SeqHdr first in the 'k' first datagrams of
+     * the batch, for flow 'f'.  Only the headers are written; the rest
+     * of the payload stays as it was built.  They all get the same
+     * time, since they go out in the same system call.
+     */
+    void stamp(Batch& b, unsigned k, const Flow& f, SeqHdr::Clock clock)
+    {
+	timespec ts;
+	clock_gettime(clock==SeqHdr::TAI ? CLOCK_TAI : CLOCK_REALTIME, &ts);
+
+	SeqHdr h;
+	h.clock = clock;
+	h.flow = f.id;
+	h.t = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	for(unsigned i=0; i<k; i++) {
+	    h.seq = f.seq + i;
+	    h.put(static_cast<uint8_t*>(b.iov[i].iov_base));
+	}
+    }
+
+    /**
+     * The CPU time the calling thread has used so far, in seconds:
+     * the total, and user and system time.
+     */
+    struct CpuTime {
+	CpuTime();
+	double cpu;
+	double utime;
+	double stime;
+    };
+
+    CpuTime::CpuTime()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+
+	rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+	stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    }
+
+    /**
+     * Send the datagrams in the schedule, a batch at a time to each
+     * of the 'flows' in turn.  A batch never spans two steps, so it
+     * doesn't run into the gap after a burst.
+     */
+    void pump(const Options& opt, std::vector<Flow>& flows,
+	      const Schedule& sched, Batch& b, Result& res)
+    {
+	const bool txtime = opt.pacing==Pacing::TXTIME;
+	Zerocopy* const zc = b.zc.get();
+	const int flags = zc ? MSG_ZEROCOPY : 0;
+	const uint64_t copied = zc ? zc->copied : 0;
+	const uint64_t zerocopied = zc ? zc->zerocopied : 0;
+	const CpuTime cpu0;
+
+	/* With user pacing, a batch goes when its first datagram is
+	 * due.  Kernel pacing gets to see datagrams up to a
+	 * millisecond before they're due, and fq needs no schedule.
+	 */
+	const uint64_t t0 = now();
+	const bool paced = opt.pacing!=Pacing::FQ;
+	const uint64_t early = txtime ? 1000000 : 0;
+	const unsigned mask = Schedule::tablesize - 1;
+	uint64_t acc = 0;
+	unsigned flow = 0;
+	bool stop = false;
+
+	for(const Schedule::Step& step : sched.steps) {
+	    const std::vector<uint16_t>& sizes = sched.sizes[step.phase];
+
+	    for(uint64_t r=0; r<step.repeat && !stop; r++) {
+		const double start = t0 + step.start + r * step.period;
+		uint64_t j = 0;
+		while(j < step.count && !stop) {
+
+		    const unsigned k = std::min<uint64_t>(b.size, step.count - j);
+		    const uint64_t due = start + j * step.interval;
+		    if(paced && due > t0) wait(due, early);
+		    if(txtime) {
+			for(unsigned i=0; i<k; i++) {
+			    b.due(i, start + (j + i) * step.interval);
+			}
+		    }
+		    for(unsigned i=0; i<k; i++) {
+			b.iov[i].iov_len = sizes[(acc + i) & mask];
+		    }
+
+		    if(zc) {
+			for(unsigned i=0; i<k && !zc->failed; i++) {
+			    b.iov[i].iov_base = zc->claim(i);
+			}
+			if(zc->failed) {
+			    res.failed = true;
+			    stop = true;
+			    break;
+			}
+		    }
+
+		    Flow& f = flows[flow++ % flows.size()];
+		    if(opt.stamp) stamp(b, k, f, opt.clock);
+
+		    const int n = sendmmsg(f.fd, b.msg.data(), k, flags);
+		    if(n==-1) {
+			const int err = errno;
+			res.count(res.errors[bucket(err)], 1);
+			if(!transient(err)) {
+			    std::cerr << "error: " << strerror(err) << '\n';
+			    res.failed = true;
+			    stop = true;
+			    break;
+			}
+			/* that one is lost; go on with the next */
+			j++;
+			acc++;
+			if(opt.backoff) {
+			    const timespec ts = { 0, long(opt.backoff) * 1000 };
+			    nanosleep(&ts, 0);
+			}
+			/* a timed trial ends even if nothing gets through */
+			stop = sched.limit && now() - t0 >= sched.limit;
+		    }
+		    else {
+			uint64_t octets = 0;
+			for(int i=0; i<n; i++) octets += b.iov[i].iov_len;
+			j += n;
+			acc += n;
+			f.seq += n;
+			if(zc) zc->sent(n, f);
+			res.count(res.sent, n);
+			res.count(res.octets, octets);
+			const uint64_t t = now();
+			res.gaps.add(t, early ? 0 : due);
+			stop = sched.limit && t - t0 >= sched.limit;
+		    }
+		}
+	    }
+	}
+
+	res.t = (now() - t0) * 1e-9;
+	if(zc) {
+	    zc->finish();
+	    if(zc->failed) res.failed = true;
+	    res.copied = zc->copied - copied;
+	    res.zerocopied = zc->zerocopied - zerocopied;
+	}
+	const CpuTime cpu;
+	res.cpu = cpu.cpu - cpu0.cpu;
+	res.utime = cpu.utime - cpu0.utime;
+	res.stime = cpu.stime - cpu0.stime;
+	res.done.store(true, std::memory_order_release);
+    }
+
+    /**
+     * The state --rtt shares between the thread sending probes and the
+     * one receiving their echoes.  When each outstanding probe was
+     * sent is kept by sequence number, modulo the size of the table,
+     * and cleared when its echo arrives, so a second echo is a
+     * duplicate.  The send and receive system calls order the sender's
+     * writes before the receiver's reads, but they're relaxed atomics
+     * anyway.
+     *
+     * With a window, the sender waits on 'cv' for echoes, and the
+     * receiver notifies it after each batch.
+     */
+    struct Rtt {
+	explicit Rtt(unsigned size)
+	    : seq(size), t(size), mask(size - 1)
+	{}
+
+	std::vector<std::atomic<uint64_t>> seq;
+	std::vector<std::atomic<uint64_t>> t;
+	const uint64_t mask;
+
+	std::atomic<uint64_t> sent {0};
+	std::atomic<uint64_t> received {0};
+	std::atomic<bool> done {false};
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	Histogram hist;
+	uint64_t reordered = 0;
+	uint64_t duplicates = 0;
+	uint64_t foreign = 0;
+    };
+
+    /**
+     * Send opt.npackets probes on 'f': at 'rate' if there is one, and
+     * with no more than opt.window of them outstanding if there is
+     * one.  If the window stays full for a second, the outstanding
+     * probes are given up on.
+     */
+    void probe(const Options& opt, Flow& f, const double rate, Rtt& rtt,
+	       Result& res)
+    {
+	Batch b(opt.batch, opt.payload, false);
+	const uint64_t t0 = now();
+	const double interval = rate ? 1e9 / rate : 0;
+	uint64_t acc = 0;
+	uint64_t forgiven = 0;
+
+	while(acc < opt.npackets) {
+
+	    unsigned k = std::min<uint64_t>(b.size, opt.npackets - acc);
+	    if(interval) wait(t0 + acc * interval, 0);
+
+	    if(opt.window) {
+		auto outstanding = [&] {
+		    const uint64_t n = rtt.received.load(std::memory_order_relaxed)
+				     + forgiven;
+		    return f.seq - std::min(f.seq, n);
+		};
+		auto room = [&] { return outstanding() < opt.window; };
+		std::unique_lock<std::mutex> lock(rtt.mutex);
+		if(!rtt.cv.wait_for(lock, std::chrono::seconds(1), room)) {
+		    forgiven += outstanding();
+		}
+		k = std::min<uint64_t>(k, opt.window - outstanding());
+	    }
+
+	    const uint64_t t = now();
+	    for(unsigned i=0; i<k; i++) {
+		const uint64_t n = (f.seq + i) & rtt.mask;
+		rtt.seq[n].store(f.seq + i, std::memory_order_relaxed);
+		rtt.t[n].store(t, std::memory_order_relaxed);
+	    }
+	    stamp(b, k, f, opt.clock);
+
+	    const int n = sendmmsg(f.fd, b.msg.data(), k, 0);
+	    if(n==-1) {
+		const int err = errno;
+		res.count(res.errors[bucket(err)], 1);
+		if(!transient(err)) {
+		    std::cerr << "error: " << strerror(err) << '\n';
+		    break;
+		}
+		acc++;
+		if(opt.backoff) {
+		    const timespec ts = { 0, long(opt.backoff) * 1000 };
+		    nanosleep(&ts, 0);
+		}
+	    }
+	    else {
+		acc += n;
+		f.seq += n;
+		rtt.sent.store(f.seq, std::memory_order_relaxed);
+		res.count(res.sent, n);
+		res.count(res.octets, n * b.iov[0].iov_len);
+	    }
+	}
+
+	res.t = (now() - t0) * 1e-9;
+	rtt.done.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Receive the echoes on 'f' and match them with their probes,
+     * until the sender is done and every probe is accounted for, or
+     * there has been a second of silence since then.  Only the
+     * header is read; the rest of each echo is discarded.
+     */
+    void echoes(const Options& opt, const Flow& f, Rtt& rtt)
+    {
+	const unsigned size = 64;
+	std::vector<uint8_t> mem(size * SeqHdr::size);
+	std::vector<iovec> iov(size);
+	std::vector<mmsghdr> msg(size);
+	for(unsigned i=0; i<size; i++) {
+	    iov[i] = { &mem[i * SeqHdr::size], SeqHdr::size };
+	    msg[i].msg_hdr = {};
+	    msg[i].msg_hdr.msg_iov = &iov[i];
+	    msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	uint64_t received = 0;
+	uint64_t highest = 0;
+	uint64_t end = 0;
+	uint64_t heard = 0;
+
+	for(;;) {
+	    if(!end && rtt.done.load(std::memory_order_acquire)) end = now();
+	    if(end) {
+		if(received==rtt.sent.load(std::memory_order_relaxed)) break;
+		if(now() - std::max(end, heard) > 1000000000) break;
+	    }
+
+	    pollfd pfd = {f.fd, POLLIN, 0};
+	    if(poll(&pfd, 1, 100) < 1) continue;
+	    const int n = recvmmsg(f.fd, msg.data(), size, MSG_DONTWAIT, 0);
+	    if(n < 1) continue;
+	    const uint64_t t = heard = now();
+
+	    for(int i=0; i<n; i++) {
+		SeqHdr h;
+		if(!h.get(&mem[i * SeqHdr::size], msg[i].msg_len) || h.flow!=f.id) {
+		    rtt.foreign++;
+		    continue;
+		}
+		const uint64_t slot = h.seq & rtt.mask;
+		const uint64_t sent = rtt.t[slot].load(std::memory_order_relaxed);
+		if(rtt.seq[slot].load(std::memory_order_relaxed)!=h.seq || !sent) {
+		    rtt.duplicates++;
+		    continue;
+		}
+		rtt.t[slot].store(0, std::memory_order_relaxed);
+		rtt.hist.add(t - sent);
+		if(received++ && h.seq < highest) {
+		    rtt.reordered++;
+		}
+		else {
+		    highest = h.seq;
+		}
+	    }
+
+	    rtt.received.store(received, std::memory_order_relaxed);
+	    if(opt.window) {
+		{ std::lock_guard<std::mutex> lock(rtt.mutex); }
+		rtt.cv.notify_one();
+	    }
+	}
+    }
+
+    /**
+     * --rtt: send probes on the first flow and time their echoes
+     * (from udpecho, or anything else which sends datagrams back
+     * as they were), concurrently so the rate doesn't depend on the
+     * round-trip time.
+     */
+    int rtt(const Options& opt, Flow& f, const double rate)
+    {
+	Rtt rtt(1 << 18);
+	Result res;
+	std::thread rx(echoes, std::cref(opt), std::cref(f), std::ref(rtt));
+	probe(opt, f, rate, rtt, res);
+	rx.join();
+
+	const uint64_t sent = res.get(res.sent);
+	std::vector<uint64_t> err(nerrors);
+	for(int i=0; i<nerrors; i++) err[i] = res.get(res.errors[i]);
+	std::cout << "send(2) says we got away " << sent << " packets"
+		  << errors(err) << '\n';
+	report(sent, res.get(res.octets), res.t, res.gaps, 0, opt.batch);
+
+	const Histogram& h = rtt.hist;
+	const uint64_t lost = sent - h.count();
+	char buf[200];
+	std::snprintf(buf, sizeof buf,
+		      "%llu echoes, %llu lost (%.3f%%), %llu reordered, "
+		      "%llu duplicates, %llu foreign\n",
+		      static_cast<unsigned long long>(h.count()),
+		      static_cast<unsigned long long>(lost),
+		      sent ? 100.0 * lost / sent : 0,
+		      static_cast<unsigned long long>(rtt.reordered),
+		      static_cast<unsigned long long>(rtt.duplicates),
+		      static_cast<unsigned long long>(rtt.foreign));
+	std::cout << buf;
+	if(!h.count()) return 1;
+
+	std::snprintf(buf, sizeof buf,
+		      "rtt min %.1f us, mean %.1f us, p50 %.1f us, p99 %.1f us, "
+		      "p99.9 %.1f us, max %.1f us\n",
+		      h.min() / 1e3, h.mean() / 1e3,
+		      h.percentile(50) / 1e3, h.percentile(99) / 1e3,
+		      h.percentile(99.9) / 1e3, h.max() / 1e3);
+	std::cout << buf;
+
+	std::cout << "      value   percentile\n";
+	for(double p : {0.0, 50.0, 75.0, 90.0, 95.0, 99.0,
+			99.9, 99.99, 99.999, 100.0}) {
+	    std::snprintf(buf, sizeof buf, "%8.1f us   %10.3f%%\n",
+			  h.percentile(p) / 1e3, p);
+	    std::cout << buf;
+	}
+	return 0;
+    }
+
+    /**
+     * A Batch per thread, kept since a --search or --sweep runs the
+     * threads many times.  Each is made by its own thread the first
+     * time it runs, so that it's allocated from that thread's malloc
+     * arena rather than next to the others (and their cache lines).
+     */
+    typedef std::vector<std::unique_ptr<Batch>> Batches;
+
+    void pump_thread(const Options& opt, std::vector<Flow>& flows,
+		     const Schedule& sched, std::unique_ptr<Batch>& batch,
+		     Result& res)
+    {
+	if(!batch) {
+	    batch.reset(new Batch(opt.batch, opt.payload,
+				  opt.pacing==Pacing::TXTIME));
+	    if(opt.zerocopy) {
+		batch->zc.reset(new Zerocopy(opt.zerocopy, opt.payload));
+	    }
+	}
+	pump(opt, flows, sched, *batch, res);
+    }
+
+    /**
+     * Run a pump thread per schedule, thread i with flows[i] and
+     * batch[i], and wait for them all; with the --interval reporter
+     * meanwhile if there is one.
+     */
+    void run(const Options& opt, std::vector<std::vector<Flow>>& flows,
+	     const std::vector<Schedule>& sched, Batches& batch,
+	     std::vector<Result>& res)
+    {
+	std::vector<std::thread> threads;
+	for(unsigned i=0; i<sched.size(); i++) {
+	    threads.push_back(std::thread(pump_thread, std::cref(opt),
+					  std::ref(flows[i]),
+					  std::cref(sched[i]),
+					  std::ref(batch[i]),
+					  std::ref(res[i])));
+	}
+
+	if(opt.interval) {
+	    reporter(res, opt.interval);
+	}
+
+	for(std::thread& t : threads) t.join();
+    }
+
+    /**
+     * Ask udpdiscard's control socket how many datagrams it has
+     * seen.  A query or its answer may get lost too, so it tries
+     * three times, a second apart.  Stale answers are thrown away
+     * first.
+     */
+    bool query(const int fd, uint64_t& n)
+    {
+	char buf[100];
+	while(recv(fd, buf, sizeof buf, MSG_DONTWAIT) >= 0) {
+	    ;
+	}
+
+	for(unsigned i=0; i<3; i++) {
+	    (void)send(fd, "s", 1, 0);
+	    pollfd pfd = {fd, POLLIN, 0};
+	    if(poll(&pfd, 1, 1000) < 1) continue;
+
+	    const ssize_t len = recv(fd, buf, sizeof buf - 1, MSG_DONTWAIT);
+	    if(len < 1) continue;
+	    buf[len] = '\0';
+	    char* end;
+	    n = std::strtoull(buf, &end, 10);
+	    return end!=buf;
+	}
+	return false;
+    }
+
+    /**
+     * One trial of the --search: 'count' datagrams of 'size' octets
+     * at 'rate' (or as fast as possible), and what the receiving end
+     * says it got.  With --zerocopy, also how the completions said
+     * the datagrams went: copied or not.
+     */
+    struct Trial {
+	double target = 0;
+	double rate = 0;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t copied = 0;
+	uint64_t zerocopied = 0;
+	double t = 0;
+	bool failed = false;
+
+	double loss() const {
+	    if(!sent || received >= sent) return 0;
+	    return 100.0 * (sent - received) / sent;
+	}
+    };
+
+    bool trial(const Options& opt, std::vector<std::vector<Flow>>& flows,
+	       Batches& batch, const int qfd, const unsigned size,
+	       const double rate, const uint64_t count, Trial& trial)
+    {
+	std::vector<Schedule> sched;
+	for(unsigned i=0; i<opt.threads; i++) {
+	    const uint64_t n = count / opt.threads + (i < count % opt.threads);
+	    sched.emplace_back(n, rate / opt.threads, size);
+	}
+
+	uint64_t before;
+	uint64_t after;
+	if(!query(qfd, before)) return false;
+
+	std::vector<Result> res(opt.threads);
+	run(opt, flows, sched, batch, res);
+
+	trial = Trial {};
+	for(const Result& r : res) {
+	    trial.sent += r.get(r.sent);
+	    trial.copied += r.copied;
+	    trial.zerocopied += r.zerocopied;
+	    trial.t = std::max(trial.t, r.t);
+	    if(r.failed) trial.failed = true;
+	}
+	if(trial.failed) return true;
+	trial.target = rate;
+	trial.rate = trial.t ? trial.sent / trial.t : 0;
+
+	/* the last ones may still be on their way */
+	const timespec ts = { 0, 200000000 };
+	nanosleep(&ts, 0);
+	if(!query(qfd, after)) return false;
+	trial.received = after - before;
+
+	char target[40] = "";
+	if(rate) std::snprintf(target, sizeof target, " (target %.0f)", rate);
+	char zc[60] = "";
+	if(opt.zerocopy) {
+	    std::snprintf(zc, sizeof zc, "; %llu zerocopied, %llu copied",
+			  static_cast<unsigned long long>(trial.zerocopied),
+			  static_cast<unsigned long long>(trial.copied));
+	}
+	char buf[300];
+	std::snprintf(buf, sizeof buf,
+		      "size %u, %.0f pps%s: %llu sent, %llu received, "
+		      "%.3f%% loss%s\n",
+		      size, trial.rate, target,
+		      static_cast<unsigned long long>(trial.sent),
+		      static_cast<unsigned long long>(trial.received),
+		      trial.loss(), zc);
+	std::cerr << buf;
+	return true;
+    }
+
+    /**
+     * --search: for each size, an RFC 2544 style search for the
+     * highest rate with no more than opt.loss percent loss, as
+     * counted by udpdiscard.  The first trial is at --rate or
+     * --bitrate, or without one, -n datagrams as fast as we can;
+     * the rate that gives is the upper bound.  After that, it's a
+     * binary search until the bounds are within 1% of each other,
+     * or 20 trials.
+     *
+     * A rate is what a trial achieved, not what it aimed for; if we
+     * cannot keep up, that's what the system under test was offered.
+     * The result is a table on stdout, with the trials on stderr.
+     */
+    int search(const std::string& host, const Options& opt,
+	       std::vector<std::vector<Flow>>& flows)
+    {
+	const std::vector<int> qfd = udpclient(host, opt.search, 1);
+	if(qfd.empty()) return 1;
+	Batches batch(opt.threads);
+
+	char buf[200];
+	std::snprintf(buf, sizeof buf,
+		      "# loss below %.3f%%, %.1f s trials, %u thread%s\n"
+		      "#  size          pps          bit/s     loss  trials\n",
+		      opt.loss, opt.trial, opt.threads,
+		      opt.threads > 1 ? "s" : "");
+	std::cout << buf << std::flush;
+
+	int rc = 0;
+	for(const unsigned size : opt.sizes) {
+
+	    double hi = opt.bitrate ? opt.bitrate / (8 * size) : opt.rate;
+	    double lo = 0;
+	    Trial best;
+	    Trial t;
+	    unsigned n = 0;
+
+	    uint64_t count = hi ? std::max(1.0, hi * opt.trial) : opt.npackets;
+	    if(!trial(opt, flows, batch, qfd[0], size, hi, count, t)) {
+		std::cerr << "error: no answer from " << host
+			  << ':' << opt.search
+			  << "; is udpdiscard -c running there?\n";
+		rc = 1;
+		break;
+	    }
+	    if(t.failed) {
+		rc = 1;
+		break;
+	    }
+	    n++;
+	    hi = t.rate;
+	    if(t.loss() <= opt.loss) {
+		best = t;
+		lo = hi;
+	    }
+
+	    while(hi - lo > hi / 100 && n < 20) {
+		const double rate = (lo + hi) / 2;
+		count = std::max(1.0, rate * opt.trial);
+		if(!trial(opt, flows, batch, qfd[0], size, rate, count, t)
+		   || t.failed) {
+		    rc = 1;
+		    break;
+		}
+		n++;
+		if(t.loss() <= opt.loss) {
+		    best = t;
+		    lo = std::max(lo, t.rate);
+		}
+		else {
+		    hi = std::min(hi, t.rate);
+		}
+	    }
+
+	    std::snprintf(buf, sizeof buf, "%7u %12.0f %14.0f %7.3f%% %6u\n",
+			  size, best.rate, best.rate * size * 8,
+			  best.loss(), n);
+	    std::cout << buf << std::flush;
+	    if(rc) break;
+	}
+
+	close(qfd[0]);
+	return rc;
+    }
+
+    /**
+     * --sweep: a trial of --trial seconds for each of opt.sizes, at
+     * --rate/--bitrate or as fast as possible, with the results as
+     * CSV: the rate, the goodput (payload bits per second) and the
+     * CPU time per datagram of the sending threads; in all, and as
+     * user and system time.  Last, with --zerocopy, the datagrams
+     * the completions say were copied and not.  The batches are made once, in the first
+     * trial, for the largest size.
+     */
+    int sweep(const Options& opt, std::vector<std::vector<Flow>>& flows)
+    {
+	Batches batch(opt.threads);
+
+	std::cout << "size,datagrams,seconds,pps,goodput_bps,"
+		  << "cpu_ns,user_ns,sys_ns,errors,copied,zerocopied\n";
+	for(const unsigned size : opt.sizes) {
+
+	    const double rate = (opt.bitrate
+				 ? opt.bitrate / (8 * size)
+				 : opt.rate) / opt.threads;
+	    std::vector<Schedule> sched;
+	    for(unsigned i=0; i<opt.threads; i++) {
+		sched.emplace_back(~uint64_t(0), rate, size);
+		sched.back().limit = opt.trial * 1e9;
+	    }
+
+	    std::vector<Result> res(opt.threads);
+	    run(opt, flows, sched, batch, res);
+
+	    uint64_t n = 0;
+	    uint64_t octets = 0;
+	    uint64_t err = 0;
+	    uint64_t copied = 0;
+	    uint64_t zerocopied = 0;
+	    double t = 0;
+	    double cpu = 0;
+	    double utime = 0;
+	    double stime = 0;
+	    bool failed = false;
+	    for(const Result& r : res) {
+		if(r.failed) failed = true;
+		n += r.get(r.sent);
+		octets += r.get(r.octets);
+		for(int i=0; i<nerrors; i++) err += r.get(r.errors[i]);
+		copied += r.copied;
+		zerocopied += r.zerocopied;
+		t = std::max(t, r.t);
+		cpu += r.cpu;
+		utime += r.utime;
+		stime += r.stime;
+	    }
+
+	    const double per = n ? 1e9 / n : 0;
+	    char buf[200];
+	    std::snprintf(buf, sizeof buf,
+			  "%u,%llu,%.3f,%.0f,%.0f,%.1f,%.1f,%.1f,"
+			  "%llu,%llu,%llu\n",
+			  size, static_cast<unsigned long long>(n), t,
+			  t > 0 ? n / t : 0, t > 0 ? octets * 8 / t : 0,
+			  cpu * per, utime * per, stime * per,
+			  static_cast<unsigned long long>(err),
+			  static_cast<unsigned long long>(copied),
+			  static_cast<unsigned long long>(zerocopied));
+	    std::cout << buf << std::flush;
+	    if(failed) return 1;
+	}
+	return 0;
     }
 
     int udppump(const std::string& host,
 		const std::string& port,
-		const unsigned npackets)
+		const Options& opt)
     {
-	int fd = udpclient(host, port);
-	if(fd == -1) {
+	const std::vector<int> fds = udpclient(host, port, opt.flows,
+					       opt.sweep ? std::cerr : std::cout);
+	if(fds.empty()) {
 	    return 1;
 	}
 
-	const char payload = 'x';
-	unsigned acc = 0;
+	const unsigned size = opt.size;
+	const bool profiled = !opt.profile.phases.empty();
 
-	for(unsigned i=0; i<npackets; ++i) {
+	/* the bit rate is of the payload; each thread gets its share,
+	 * and so does each flow in a thread
+	 */
+	const double rate = (opt.bitrate
+			     ? opt.bitrate / (8 * size)
+			     : opt.rate) / opt.threads;
 
-	    ssize_t n = send(fd, &payload, sizeof payload, 0);
-	    if(n==-1) {
-		std::cerr << "error: " << strerror(errno) << '\n';
-		break;
+	if(opt.rtt) {
+	    Flow f {fds[0], 0, 0};
+	    const int rc = rtt(opt, f, rate);
+	    close(fds[0]);
+	    return rc;
+	}
+
+	std::vector<Schedule> sched;
+	for(unsigned i=0; i<opt.threads; i++) {
+	    if(profiled) {
+		sched.emplace_back(opt.profile, 1.0 / opt.threads, size);
 	    }
 	    else {
-		acc += n/(sizeof payload);
+		const uint64_t n = opt.npackets / opt.threads
+				 + (i < opt.npackets % opt.threads);
+		sched.emplace_back(n, rate, size);
 	    }
 	}
 
-	std::cout << "send(2) says we got away " << acc << " packets\n";
+	/* thread i gets flows i, i + threads, ... */
+	std::vector<std::vector<Flow>> flows(opt.threads);
+	for(unsigned i=0; i<fds.size(); i++) {
+	    flows[i % opt.threads].push_back(Flow {fds[i], i, 0});
+	}
+
+	for(const std::vector<Flow>& v : flows) {
+	    for(const Flow& f : v) {
+		if(!pacing(f.fd, opt, rate / v.size(), size + 28)) {
+		    std::cerr << "error: cannot set up kernel pacing: "
+			      << strerror(errno) << '\n';
+		    return 1;
+		}
+		const int one = 1;
+		if(opt.zerocopy &&
+		   setsockopt(f.fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one)) {
+		    std::cerr << "error: cannot set up SO_ZEROCOPY: "
+			      << strerror(errno) << '\n';
+		    return 1;
+		}
+	    }
+	}
+
+	if(!opt.search.empty() || opt.sweep) {
+	    const int rc = opt.sweep ? sweep(opt, flows)
+				     : search(host, opt, flows);
+	    for(int fd : fds) close(fd);
+	    return rc;
+	}
 
-	return close(fd);
+	Batches batch(opt.threads);
+	std::vector<Result> res(opt.threads);
+	run(opt, flows, sched, batch, res);
+
+	uint64_t acc = 0;
+	uint64_t octets = 0;
+	uint64_t copied = 0;
+	uint64_t zerocopied = 0;
+	double t = 0;
+	bool failed = false;
+	std::vector<uint64_t> err(nerrors);
+	for(unsigned i=0; i<opt.threads; i++) {
+	    if(res[i].failed) failed = true;
+	    acc += res[i].get(res[i].sent);
+	    octets += res[i].get(res[i].octets);
+	    copied += res[i].copied;
+	    zerocopied += res[i].zerocopied;
+	    t = std::max(t, res[i].t);
+	    for(int j=0; j<nerrors; j++) err[j] += res[i].get(res[i].errors[j]);
+	}
+
+	std::cout << "send(2) says we got away " << acc << " packets";
+	std::cout << errors(err) << '\n';
+	if(opt.threads > 1) {
+	    for(unsigned i=0; i<opt.threads; i++) {
+		std::cout << "thread " << i << ": ";
+		report(res[i].get(res[i].sent), res[i].get(res[i].octets),
+		       res[i].t, res[i].gaps, rate, opt.batch);
+	    }
+	    std::cout << "total: ";
+	}
+	report(acc, octets, t, res[0].gaps,
+	       opt.threads > 1 ? 0 : rate, opt.batch);
+	if(opt.zerocopy) {
+	    const uint64_t n = copied + zerocopied;
+	    char buf[100];
+	    std::snprintf(buf, sizeof buf,
+			  "zerocopy: %.1f%% of %llu completions; %llu copied\n",
+			  n ? 100.0 * zerocopied / n : 0,
+			  static_cast<unsigned long long>(n),
+			  static_cast<unsigned long long>(copied));
+	    std::cout << buf;
+	}
+	if(opt.pacing==Pacing::FQ && t * rate * opt.threads < 0.5 * acc) {
+	    std::cerr << "warning: no sign of kernel pacing; "
+		      << "is there an fq qdisc on the interface?\n";
+	}
+
+	for(int fd : fds) close(fd);
+	return failed ? 1 : 0;
     }
 }
 
@@ -102,23 +1519,215 @@ int main(int argc, char ** argv)
     const string prog = argv[0];
     const string usage = string("usage: ")
 	+ prog
-	+ " [-n packets] host port";
+	+ " [-n packets] [--rate pps | --bitrate bps]"
+	+ " [--pacing=user|fq|txtime] [--size N] [--payload-hex hex]"
+	+ " [--batch N] [--threads N] [--flows N]"
+	+ " [--stamp[=realtime|tai]] [--interval s] [--backoff us]"
+	+ " [--profile file] [--zerocopy[=N]] [--rtt[=N]]"
+	+ " [--search control-port [--loss %] [--trial s] [--sizes N,...]]"
+	+ " [--sweep N,... [--trial s]]"
+	+ " host port[-port]";
     const char optstring[] = "+n:";
     struct option long_options[] = {
 	{"packets", 0, 0, 'p'},
 	{"version", 0, 0, 'v'},
 	{"help", 0, 0, 'h'},
+	{"rate", 1, 0, 'r'},
+	{"bitrate", 1, 0, 'b'},
+	{"pacing", 1, 0, 'P'},
+	{"size", 1, 0, 's'},
+	{"payload-hex", 1, 0, 'x'},
+	{"batch", 1, 0, 'B'},
+	{"threads", 1, 0, 'T'},
+	{"flows", 1, 0, 'F'},
+	{"stamp", 2, 0, 'S'},
+	{"interval", 1, 0, 'i'},
+	{"backoff", 1, 0, 'k'},
+	{"profile", 1, 0, 'L'},
+	{"zerocopy", 2, 0, 'Z'},
+	{"rtt", 2, 0, 'R'},
+	{"search", 1, 0, 'Q'},
+	{"loss", 1, 0, 'l'},
+	{"trial", 1, 0, 'D'},
+	{"sizes", 1, 0, 'z'},
+	{"sweep", 1, 0, 'W'},
 	{0, 0, 0, 0}
     };
 
-    unsigned npackets = 1000000;
+    Options opt;
+    size_t size = 0;
+    std::vector<uint8_t> pattern(1, 'x');
+    bool count = false;
 
     int ch;
     while((ch = getopt_long(argc, argv,
 			    optstring, &long_options[0], 0)) != -1) {
 	switch(ch) {
 	case 'n':
-	    npackets = std::atol(optarg);
+	    opt.npackets = std::strtoull(optarg, 0, 10);
+	    count = true;
+	    break;
+	case 'r':
+	    opt.rate = std::strtod(optarg, 0);
+	    if(opt.rate <= 0) {
+		std::cerr << "error: bad rate " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'b':
+	    opt.bitrate = std::strtod(optarg, 0);
+	    if(opt.bitrate <= 0) {
+		std::cerr << "error: bad bit rate " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 's':
+	    size = std::strtoul(optarg, 0, 10);
+	    if(size < 1 || size > 65507) {
+		std::cerr << "error: the size must be 1--65507\n";
+		return 1;
+	    }
+	    break;
+	case 'x':
+	    {
+		const char* a = optarg;
+		const char* const b = a + std::strlen(a);
+		pattern.resize(b - a);
+		pattern.resize(hexread(pattern.data(), &a, b));
+		if(a!=b || pattern.empty()) {
+		    std::cerr << "error: bad hex payload \"" << optarg << "\"\n";
+		    return 1;
+		}
+	    }
+	    break;
+	case 'B':
+	    opt.batch = std::strtoul(optarg, 0, 10);
+	    if(opt.batch < 1 || opt.batch > 1024) {
+		std::cerr << "error: the batch size must be 1--1024\n";
+		return 1;
+	    }
+	    break;
+	case 'T':
+	    opt.threads = std::strtoul(optarg, 0, 10);
+	    if(opt.threads < 1 || opt.threads > 1024) {
+		std::cerr << "error: the number of threads must be 1--1024\n";
+		return 1;
+	    }
+	    break;
+	case 'F':
+	    opt.flows = std::strtoul(optarg, 0, 10);
+	    if(opt.flows < 1 || opt.flows > 65535) {
+		std::cerr << "error: the number of flows must be 1--65535\n";
+		return 1;
+	    }
+	    break;
+	case 'i':
+	    opt.interval = std::strtod(optarg, 0);
+	    if(opt.interval < 0.001) {
+		std::cerr << "error: bad interval " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'k':
+	    opt.backoff = std::strtoul(optarg, 0, 10);
+	    if(opt.backoff > 999999) {
+		std::cerr << "error: the backoff must be below a second\n";
+		return 1;
+	    }
+	    break;
+	case 'Q':
+	    opt.search = optarg;
+	    break;
+	case 'l':
+	    opt.loss = std::strtod(optarg, 0);
+	    if(opt.loss < 0 || opt.loss >= 100) {
+		std::cerr << "error: bad loss threshold " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'D':
+	    opt.trial = std::strtod(optarg, 0);
+	    if(opt.trial < 0.01) {
+		std::cerr << "error: bad trial duration " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'z':
+	case 'W':
+	    if(!opt.sizes.empty()) {
+		std::cerr << "error: --sizes and --sweep both give the sizes;"
+			  << " use one of them, once\n";
+		return 1;
+	    }
+	    if(!sizes(optarg, opt.sizes)) {
+		std::cerr << "error: bad sizes " << optarg << '\n';
+		return 1;
+	    }
+	    if(ch=='W') opt.sweep = true;
+	    break;
+	case 'R':
+	    opt.rtt = true;
+	    opt.window = optarg ? std::strtoul(optarg, 0, 10) : 0;
+	    if(optarg && (opt.window < 1 || opt.window > 100000)) {
+		std::cerr << "error: the --rtt window must be 1--100000\n";
+		return 1;
+	    }
+	    break;
+	case 'Z':
+	    opt.zerocopy = optarg ? std::strtoul(optarg, 0, 10) : 128;
+	    if(opt.zerocopy < 1 || opt.zerocopy > 65536) {
+		std::cerr << "error: the zerocopy ring must be 1--65536 buffers\n";
+		return 1;
+	    }
+	    break;
+	case 'L':
+	    {
+		std::ifstream is(optarg);
+		if(!is) {
+		    std::cerr << "error: cannot open " << optarg
+			      << ": " << strerror(errno) << '\n';
+		    return 1;
+		}
+		std::string s;
+		unsigned n = 0;
+		while(std::getline(is, s)) {
+		    n++;
+		    if(!opt.profile.add(s)) {
+			std::cerr << optarg << ':' << n
+				  << ": error: bad phase \"" << s << "\"\n";
+			return 1;
+		    }
+		}
+		if(opt.profile.phases.empty()) {
+		    std::cerr << "error: no phases in " << optarg << '\n';
+		    return 1;
+		}
+	    }
+	    break;
+	case 'S':
+	    opt.stamp = true;
+	    if(!optarg || string(optarg)=="realtime") {
+		opt.clock = SeqHdr::REALTIME;
+	    }
+	    else if(string(optarg)=="tai") {
+		opt.clock = SeqHdr::TAI;
+	    }
+	    else {
+		std::cerr << "error: no such clock: " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'P':
+	    if(string(optarg)=="fq") {
+		opt.pacing = Pacing::FQ;
+	    }
+	    else if(string(optarg)=="txtime") {
+		opt.pacing = Pacing::TXTIME;
+	    }
+	    else if(string(optarg)!="user") {
+		std::cerr << "error: no such pacing: " << optarg << '\n';
+		return 1;
+	    }
 	    break;
 	case 'h':
 	    std::cout << usage << '\n';
@@ -143,8 +1752,93 @@ int main(int argc, char ** argv)
 	return 1;
     }
 
+    const bool profiled = !opt.profile.phases.empty();
+    if(profiled && (count || opt.rate || opt.bitrate)) {
+	std::cerr << "error: the profile sets the rate and the count\n";
+	return 1;
+    }
+    if(profiled && opt.pacing==Pacing::FQ) {
+	std::cerr << "error: a profile cannot be paced by fq\n";
+	return 1;
+    }
+    if(opt.rtt && (profiled || opt.threads > 1 || opt.flows > 1 ||
+		   opt.zerocopy || opt.interval || opt.pacing!=Pacing::USER)) {
+	std::cerr << "error: --rtt is one flow, paced by udppump,"
+		  << " with no profile, zerocopy or intervals\n";
+	return 1;
+    }
+    const bool searching = !opt.search.empty();
+    if((searching || opt.sweep) &&
+       (profiled || opt.rtt || opt.pacing==Pacing::FQ)) {
+	std::cerr << "error: --search and --sweep cannot have a profile,"
+		  << " --rtt or fq pacing\n";
+	return 1;
+    }
+    if(searching && opt.sweep) {
+	std::cerr << "error: --search or --sweep, not both\n";
+	return 1;
+    }
+    if(searching && opt.sizes.empty()) {
+	/* the RFC 2544 Ethernet frame sizes, less the Ethernet, IPv4
+	 * and UDP headers
+	 */
+	if(size) opt.sizes = {unsigned(size)};
+	else opt.sizes = {18, 82, 210, 466, 978, 1234, 1472};
+    }
+
+    if(opt.rtt) {
+	/* without a rate, a ping-pong */
+	if(!opt.window && !opt.rate && !opt.bitrate) opt.window = 1;
+	opt.stamp = true;
+    }
+
+    if(opt.pacing!=Pacing::USER && !opt.rate && !opt.bitrate && !profiled) {
+	std::cerr << "error: --pacing needs a rate\n";
+	return 1;
+    }
+
+    /* at least one flow per thread, and a zerocopy buffer per
+     * datagram in a batch
+     */
+    opt.flows = std::max(opt.flows, opt.threads);
+    if(opt.zerocopy) opt.zerocopy = std::max(opt.zerocopy, opt.batch);
+
+    /* the pattern, repeated or cut to size, with room for the
+     * header if there is one
+     */
+    if(opt.stamp && size && size < SeqHdr::size) {
+	std::cerr << "error: --stamp needs a size of at least "
+		  << SeqHdr::size << '\n';
+	return 1;
+    }
+    if(!size) size = pattern.size();
+    if(opt.stamp) size = std::max<size_t>(size, SeqHdr::size);
+    opt.size = size;
+    if(profiled) {
+	const Schedule sched(opt.profile, 1, size);
+	if(opt.stamp && sched.minsize() < SeqHdr::size) {
+	    std::cerr << "error: --stamp needs sizes of at least "
+		      << SeqHdr::size << '\n';
+	    return 1;
+	}
+	size = std::max<size_t>(size, sched.maxsize());
+    }
+    if(searching || opt.sweep) {
+	for(unsigned n : opt.sizes) {
+	    if(opt.stamp && n < SeqHdr::size) {
+		std::cerr << "error: --stamp needs sizes of at least "
+			  << SeqHdr::size << '\n';
+		return 1;
+	    }
+	    size = std::max<size_t>(size, n);
+	}
+    }
+    for(size_t i=0; i<size; i++) {
+	opt.payload.push_back(pattern[i % pattern.size()]);
+    }
+
     const string host = argv[optind++];
     const string port = argv[optind++];
 
-    return udppump(host, port, npackets);
+    return udppump(host, port, opt);
 }
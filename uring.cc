@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ */
+#include "uring.h"
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+namespace {
+
+    int setup(unsigned entries, io_uring_params* p)
+    {
+	return syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    int enter(int fd, unsigned to_submit, unsigned min_complete,
+	      unsigned flags)
+    {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, nullptr, 0);
+    }
+
+    int reg(int fd, unsigned opcode, void* arg, unsigned nargs)
+    {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+    }
+
+    template <class T>
+    T* at(void* base, unsigned offset)
+    {
+	return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    void* map(int fd, size_t len, off_t offset)
+    {
+	void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+	return p==MAP_FAILED ? nullptr : p;
+    }
+}
+
+
+Uring::Uring(unsigned entries)
+    : err(0),
+      fd(-1),
+      sq {},
+      cq {},
+      sq_map(nullptr),
+      sq_maplen(0),
+      cq_map(nullptr),
+      cq_maplen(0),
+      sqe_map(nullptr),
+      sqe_maplen(0)
+{
+    io_uring_params p {};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 4*entries;
+
+    fd = setup(entries, &p);
+    if(fd==-1) {
+	err = errno;
+	return;
+    }
+
+    sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_maplen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    sqe_maplen = p.sq_entries * sizeof(io_uring_sqe);
+
+    sq_map = map(fd, sq_maplen, IORING_OFF_SQ_RING);
+    cq_map = map(fd, cq_maplen, IORING_OFF_CQ_RING);
+    sqe_map = map(fd, sqe_maplen, IORING_OFF_SQES);
+    if(!sq_map || !cq_map || !sqe_map) {
+	err = errno;
+	return;
+    }
+
+    sq.head = at<unsigned>(sq_map, p.sq_off.head);
+    sq.tail = at<unsigned>(sq_map, p.sq_off.tail);
+    sq.mask = *at<unsigned>(sq_map, p.sq_off.ring_mask);
+    sq.entries = *at<unsigned>(sq_map, p.sq_off.ring_entries);
+    sq.array = at<unsigned>(sq_map, p.sq_off.array);
+    sq.sqes = static_cast<io_uring_sqe*>(sqe_map);
+    sq.local_tail = *sq.tail;
+    sq.pending = 0;
+
+    /* the submission index array is an identity mapping */
+    for(unsigned i=0; i<sq.entries; i++) {
+	sq.array[i] = i;
+    }
+
+    cq.head = at<unsigned>(cq_map, p.cq_off.head);
+    cq.tail = at<unsigned>(cq_map, p.cq_off.tail);
+    cq.mask = *at<unsigned>(cq_map, p.cq_off.ring_mask);
+    cq.cqes = at<io_uring_cqe>(cq_map, p.cq_off.cqes);
+}
+
+
+Uring::~Uring()
+{
+    if(sqe_map) munmap(sqe_map, sqe_maplen);
+    if(cq_map) munmap(cq_map, cq_maplen);
+    if(sq_map) munmap(sq_map, sq_maplen);
+    if(fd!=-1) close(fd);
+}
+
+
+/**
+ * True if the kernel knows about operation 'op'.
+ */
+bool Uring::probe(unsigned op) const
+{
+    const unsigned nops = 256;
+    char mem[sizeof(io_uring_probe) + nops*sizeof(io_uring_probe_op)] = {};
+    io_uring_probe* p = reinterpret_cast<io_uring_probe*>(mem);
+
+    if(reg(fd, IORING_REGISTER_PROBE, p, nops) == -1) return false;
+    if(op > p->last_op) return false;
+    return p->ops[op].flags & IO_URING_OP_SUPPORTED;
+}
+
+
+/**
+ * The next free submission queue entry, cleared, or null if the
+ * queue is full and needs a submit().
+ */
+io_uring_sqe* Uring::sqe()
+{
+    const unsigned head = __atomic_load_n(sq.head, __ATOMIC_ACQUIRE);
+    if(sq.local_tail - head >= sq.entries) return nullptr;
+
+    io_uring_sqe* const e = &sq.sqes[sq.local_tail & sq.mask];
+    std::memset(e, 0, sizeof *e);
+    sq.local_tail++;
+    sq.pending++;
+    return e;
+}
+
+
+/**
+ * Submit whatever is pending, and wait until there are at least
+ * 'wait' completions.  Returns -1 and sets errno on failure,
+ * including EINTR.
+ */
+int Uring::submit(unsigned wait)
+{
+    __atomic_store_n(sq.tail, sq.local_tail, __ATOMIC_RELEASE);
+    const int n = enter(fd, sq.pending, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0);
+    if(n > 0) {
+	sq.pending -= n;
+    }
+    return n;
+}
+
+
+BufRing::BufRing(Uring& ring, unsigned bgid, unsigned count, size_t size)
+    : err(0),
+      bgid(bgid),
+      count(count),
+      size(size),
+      ring(ring),
+      br(nullptr),
+      brlen(count * sizeof(io_uring_buf)),
+      mem(nullptr),
+      tail(0),
+      added(0)
+{
+    void* p = mmap(nullptr, brlen, PROT_READ | PROT_WRITE,
+		   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    void* q = mmap(nullptr, count*size, PROT_READ | PROT_WRITE,
+		   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(p==MAP_FAILED || q==MAP_FAILED) {
+	err = errno;
+	if(p!=MAP_FAILED) munmap(p, brlen);
+	if(q!=MAP_FAILED) munmap(q, count*size);
+	return;
+    }
+    br = static_cast<io_uring_buf*>(p);
+    mem = static_cast<char*>(q);
+
+    io_uring_buf_reg r {};
+    r.ring_addr = reinterpret_cast<unsigned long>(br);
+    r.ring_entries = count;
+    r.bgid = bgid;
+    if(reg(ring.fd, IORING_REGISTER_PBUF_RING, &r, 1) == -1) {
+	err = errno;
+	return;
+    }
+
+    for(unsigned bid=0; bid<count; bid++) {
+	recycle(bid);
+    }
+    publish();
+}
+
+
+BufRing::~BufRing()
+{
+    if(!err) {
+	io_uring_buf_reg r {};
+	r.bgid = bgid;
+	reg(ring.fd, IORING_UNREGISTER_PBUF_RING, &r, 1);
+    }
+    if(mem) munmap(mem, count*size);
+    if(br) munmap(br, brlen);
+}
+
+
+void BufRing::recycle(unsigned bid)
+{
+    io_uring_buf& b = br[(tail + added) & (count - 1)];
+    b.addr = reinterpret_cast<unsigned long>(buf(bid));
+    b.len = size;
+    b.bid = bid;
+    added++;
+}
+
+
+void BufRing::publish()
+{
+    tail += added;
+    added = 0;
+    /* the tail overlays the first entry's 'resv' */
+    __atomic_store_n(&br[0].resv, tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 Jrgen Grahn.
+ * All rights reserved.
+ *
+ * Just enough of the Linux io_uring(7) interface for a UDP event
+ * loop, directly on top of the system calls.
+ */
+#ifndef UDPTOOLS_URING_H
+#define UDPTOOLS_URING_H
+#include <linux/io_uring.h>
+#include <cstddef>
+
+
+/**
+ * A submission queue and completion queue, or a failure to set them
+ * up (in which case 'err' is an errno value).  There may be at least
+ * 'entries' submissions pending, and four times as many completions.
+ */
+class Uring {
+public:
+    explicit Uring(unsigned entries);
+    ~Uring();
+
+    int err;
+    int fd;
+
+    bool probe(unsigned op) const;
+
+    io_uring_sqe* sqe();
+    int submit(unsigned wait);
+
+    template <class F> unsigned reap(F f);
+
+private:
+    struct {
+	unsigned* head;
+	unsigned* tail;
+	unsigned mask;
+	unsigned entries;
+	unsigned* array;
+	io_uring_sqe* sqes;
+	unsigned local_tail;
+	unsigned pending;
+    } sq;
+
+    struct {
+	unsigned* head;
+	unsigned* tail;
+	unsigned mask;
+	io_uring_cqe* cqes;
+    } cq;
+
+    void* sq_map;
+    size_t sq_maplen;
+    void* cq_map;
+    size_t cq_maplen;
+    void* sqe_map;
+    size_t sqe_maplen;
+
+    Uring(const Uring&);
+    Uring& operator= (const Uring&);
+};
+
+
+/**
+ * Call f(cqe) for each completion available right now, and hand
+ * them back to the kernel.  Returns the number of completions.
+ */
+template <class F>
+unsigned Uring::reap(F f)
+{
+    unsigned head = *cq.head;
+    const unsigned tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    while(head != tail) {
+	f(cq.cqes[head & cq.mask]);
+	head++;
+	n++;
+    }
+    __atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+
+/**
+ * A ring of 'count' buffers of 'size' octets each, provided to the
+ * kernel as buffer group 'bgid', for operations with
+ * IOSQE_BUFFER_SELECT.  When the kernel has picked a buffer and we're
+ * done with it, it goes back with recycle(), and recycled buffers
+ * become available to the kernel again with publish().  'count'
+ * must be a power of two.
+ */
+class BufRing {
+public:
+    BufRing(Uring& ring, unsigned bgid, unsigned count, size_t size);
+    ~BufRing();
+
+    int err;
+    const unsigned bgid;
+    const unsigned count;
+    const size_t size;
+
+    char* buf(unsigned bid) const { return mem + bid*size; }
+    void recycle(unsigned bid);
+    void publish();
+
+private:
+    Uring& ring;
+    io_uring_buf* br;
+    size_t brlen;
+    char* mem;
+    unsigned short tail;
+    unsigned short added;
+
+    BufRing(const BufRing&);
+    BufRing& operator= (const BufRing&);
+};
+
+#endif